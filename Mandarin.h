@@ -28,8 +28,18 @@ namespace MDCC {
     COND_GE = 4,
     COND_LE = 5,
 
+    // Unsigned conditions, tested on the flags of an unsigned cmp.
+    COND_UGR = 6,
+    COND_ULS = 7,
+    COND_UGE = 8,
+    COND_ULE = 9,
+
     COND_INVALID = -1
   };
+
+  inline static bool isUnsigned(CondCodes CC) {
+    return CC >= COND_UGR && CC <= COND_ULE;
+  }
 }
 
 namespace llvm {
@@ -38,6 +48,8 @@ namespace llvm {
   class formatted_raw_ostream;
 
   FunctionPass *createMandarinISelDag(MandarinTargetMachine &TM);
+  FunctionPass *createMandarinLoadStoreOptimizerPass();
+  FunctionPass *createMandarinRegUsageCollectorPass(MandarinTargetMachine &TM);
 
 } // end namespace llvm;
 
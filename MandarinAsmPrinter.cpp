@@ -21,7 +21,9 @@
 #include "llvm/CodeGen/MachineInstr.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/MachineConstantPool.h"
+#include "llvm/CodeGen/MachineJumpTableInfo.h"
 #include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCExpr.h"
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/MC/MCSymbol.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -69,18 +71,12 @@ namespace {
     void printOperand(const MachineInstr *MI, int opNum, raw_ostream &OS);
     void printMemOperand(const MachineInstr *MI, int opNum, raw_ostream &OS,
                          const char *Modifier = 0);
+    void printMemRIOperand(const MachineInstr *MI, int opNum, raw_ostream &OS);
 	void printBasicBlock(const MachineInstr *MI, int opNum, raw_ostream &OS);
     void printCCOperand(const MachineInstr *MI, int opNum, raw_ostream &OS);
-	
-	template<int N>
-	void printQuadRegOff(const MachineInstr *MI, int opNum, raw_ostream &OS)
-	{
-		printQuadRegOffN(MI, opNum, OS, N);
-	}
-
-	void printQuadRegOffN(const MachineInstr *MI, int opNum, raw_ostream &OS, int N);
 
 	virtual void EmitConstantPool();
+	virtual void EmitJumpTableInfo();
     virtual void EmitInstruction(const MachineInstr *MI) {
       SmallString<128> Str;
       raw_svector_ostream OS(Str);
@@ -149,6 +145,41 @@ void MandarinAsmPrinter::EmitConstantPool()
     }
 }
 
+/// EmitJumpTableInfo - Jump tables are emitted as data, in the same format
+/// as the constant pool entries.
+void MandarinAsmPrinter::EmitJumpTableInfo()
+{
+	const MachineJumpTableInfo *MJTI = MF->getJumpTableInfo();
+	if (!MJTI) return;
+
+	const std::vector<MachineJumpTableEntry> &JT = MJTI->getJumpTables();
+	if (JT.empty()) return;
+
+	const MCSection *S = TM.getTargetLowering()->getObjFileLowering().getDataSection();
+
+	OutStreamer.SwitchSection(S);
+
+	unsigned EntrySize = MJTI->getEntrySize(*TM.getDataLayout());
+
+	for (unsigned JTI = 0, e = JT.size(); JTI != e; ++JTI)
+	{
+		const std::vector<MachineBasicBlock*> &JTBBs = JT[JTI].MBBs;
+		if (JTBBs.empty())
+			continue;
+
+		SmallString<128> Str;
+		raw_svector_ostream OS(Str);
+
+		OS << "\t" << *GetJTISymbol(JTI);
+
+		HackStreamer(OutStreamer) << OS.str();
+
+		for (unsigned i = 0, e = JTBBs.size(); i != e; ++i)
+			OutStreamer.EmitValue(MCSymbolRefExpr::Create(JTBBs[i]->getSymbol(),
+			                                              OutContext), EntrySize);
+	}
+}
+
 void MandarinAsmPrinter::printOperand(const MachineInstr *MI, int opNum,
                                    raw_ostream &O)
 {
@@ -201,6 +232,7 @@ void MandarinAsmPrinter::printOperand(const MachineInstr *MI, int opNum,
 		return;
 	case MachineOperand::MO_GlobalAddress:
 		O << *getSymbol(MO.getGlobal());
+		printOffset(MO.getOffset(), O);
 		break;
 	case MachineOperand::MO_BlockAddress:
 		O <<  GetBlockAddressSymbol(MO.getBlockAddress())->getName();
@@ -211,6 +243,11 @@ void MandarinAsmPrinter::printOperand(const MachineInstr *MI, int opNum,
 	case MachineOperand::MO_ConstantPoolIndex:
 		O << MAI->getPrivateGlobalPrefix() << "CPI" << getFunctionNumber() << "_"
 			<< MO.getIndex();
+		printOffset(MO.getOffset(), O);
+		break;
+	case MachineOperand::MO_JumpTableIndex:
+		O << MAI->getPrivateGlobalPrefix() << "JTI" << getFunctionNumber() << "_"
+			<< MO.getIndex();
 		break;
 	default:
 		llvm_unreachable("<unknown operand type>");
@@ -225,6 +262,18 @@ void MandarinAsmPrinter::printMemOperand(const MachineInstr *MI, int opNum,
   printOperand(MI, opNum, O);
 }
 
+void MandarinAsmPrinter::printMemRIOperand(const MachineInstr *MI, int opNum,
+                                          raw_ostream &O)
+{
+	printOperand(MI, opNum, O);
+
+	int Offset = (int)MI->getOperand(opNum + 1).getImm();
+	if (Offset > 0)
+		O << "+" << Offset;
+	else if (Offset < 0)
+		O << Offset;
+}
+
 void MandarinAsmPrinter::printBasicBlock(const MachineInstr *MI, int opNum, raw_ostream &O)
 {
   printOperand(MI, opNum, O);
@@ -245,60 +294,26 @@ void MandarinAsmPrinter::printCCOperand(const MachineInstr *MI, int opNum,
 	case MDCC::COND_NE:
 		O << "ne";
 		break;
+	// The unsigned conditions only differ in the compare that sets the flags.
 	case MDCC::COND_GR:
+	case MDCC::COND_UGR:
 		O << "gr";
 		break;
 	case MDCC::COND_LS:
+	case MDCC::COND_ULS:
 		O << "ls";
 		break;
 	case MDCC::COND_GE:
+	case MDCC::COND_UGE:
 		O << "ge";
 		break;
 	case MDCC::COND_LE:
+	case MDCC::COND_ULE:
 		O << "le";
 		break;
 	}
 }
 
-void MandarinAsmPrinter::printQuadRegOffN(const MachineInstr *MI, int opNum, raw_ostream &OS, int N)
-{
-	const llvm::TargetRegisterInfo *regInfo = TM.getRegisterInfo();
-
-	const MachineOperand &MO = MI->getOperand(opNum);
-
-	unsigned reg = MO.getReg();
-
-	if(MD::QuadRegsRegClass.contains(reg))
-	{
-		switch(N)
-		{
-		case 0:
-			OS << StringRef(getRegisterName(regInfo->getSubReg(reg, MD::r4sub0))).lower();
-			break;
-		case 1:
-			OS << StringRef(getRegisterName(regInfo->getSubReg(reg, MD::r4sub1))).lower();
-			break;
-		case 2:
-			OS << StringRef(getRegisterName(regInfo->getSubReg(reg, MD::r4sub2))).lower();
-			break;
-		case 3:
-			OS << StringRef(getRegisterName(regInfo->getSubReg(reg, MD::r4sub3))).lower();
-			break;
-		}
-	}else if(MD::DoubleRegsRegClass.contains(reg)){
-		switch(N)
-		{
-		case 0:
-			OS << StringRef(getRegisterName(regInfo->getSubReg(reg, MD::r2sub0))).lower();
-			break;
-		case 1:
-			OS << StringRef(getRegisterName(regInfo->getSubReg(reg, MD::r2sub1))).lower();
-			break;
-		}
-	}
-	OS << "/*" << StringRef(getRegisterName(reg)).lower() << "_" << N << "*/";
-}
-
 /// PrintAsmOperand - Print out an operand for an inline asm expression.
 ///
 bool MandarinAsmPrinter::PrintAsmOperand(const MachineInstr *MI, unsigned OpNo,
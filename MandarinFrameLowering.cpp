@@ -95,8 +95,9 @@ void MandarinFrameLowering::emitEpilogue(MachineFunction &MF,
   unsigned RetOpcode = MBBI->getOpcode();
   DebugLoc DL = MBBI->getDebugLoc();
 
-  assert(RetOpcode == MD::RET &&
-         "Can only put epilog before 'ret' instruction!");
+  assert((RetOpcode == MD::RET || RetOpcode == MD::TAILCALLi ||
+          RetOpcode == MD::TAILCALLr) &&
+         "Can only put epilog before 'ret' or tail call instruction!");
 
   uint64_t StackSize = MFI->getStackSize();
 
@@ -115,6 +116,51 @@ void MandarinFrameLowering::emitEpilogue(MachineFunction &MF,
   }
 }
 
+/// spillCalleeSavedRegisters - The callee-saved registers are the quads and
+/// the pair covering R16-R29, each used one is saved by a single store[N].
+bool MandarinFrameLowering::
+spillCalleeSavedRegisters(MachineBasicBlock &MBB,
+                          MachineBasicBlock::iterator MI,
+                          const std::vector<CalleeSavedInfo> &CSI,
+                          const TargetRegisterInfo *TRI) const {
+  if (CSI.empty())
+    return false;
+
+  MachineFunction &MF = *MBB.getParent();
+  const TargetInstrInfo &TII = *MF.getTarget().getInstrInfo();
+
+  for (unsigned i = 0, e = CSI.size(); i != e; ++i) {
+    unsigned Reg = CSI[i].getReg();
+    const TargetRegisterClass *RC = TRI->getMinimalPhysRegClass(Reg);
+
+    // The register is live-in, its value is only read by the save.
+    MBB.addLiveIn(Reg);
+    TII.storeRegToStackSlot(MBB, MI, Reg, true, CSI[i].getFrameIdx(), RC, TRI);
+  }
+
+  return true;
+}
+
+bool MandarinFrameLowering::
+restoreCalleeSavedRegisters(MachineBasicBlock &MBB,
+                            MachineBasicBlock::iterator MI,
+                            const std::vector<CalleeSavedInfo> &CSI,
+                            const TargetRegisterInfo *TRI) const {
+  if (CSI.empty())
+    return false;
+
+  MachineFunction &MF = *MBB.getParent();
+  const TargetInstrInfo &TII = *MF.getTarget().getInstrInfo();
+
+  for (unsigned i = CSI.size(); i != 0; --i) {
+    unsigned Reg = CSI[i - 1].getReg();
+    const TargetRegisterClass *RC = TRI->getMinimalPhysRegClass(Reg);
+    TII.loadRegFromStackSlot(MBB, MI, Reg, CSI[i - 1].getFrameIdx(), RC, TRI);
+  }
+
+  return true;
+}
+
 bool MandarinFrameLowering::hasReservedCallFrame(const MachineFunction &MF) const {
   // Reserve call frame if there are no variable sized objects on the stack.
   return !MF.getFrameInfo()->hasVarSizedObjects();
@@ -11,7 +11,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "MandarinTargetMachine.h"
+#include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/SelectionDAGISel.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
@@ -40,10 +42,14 @@ public:
       TM(tm) {
   }
 
+  virtual void PreprocessISelDAG();
   SDNode *Select(SDNode *N);
+  SDNode *SelectImmediate(SDNode *N);
 
   // Complex Pattern Selectors.
   bool SelectAddr(SDValue N, SDValue &R1);
+  bool SelectAddrRI(SDValue N, SDValue &Base, SDValue &Offset);
+  bool SelectAddrImm(SDValue N, SDValue &Imm);
 
   virtual const char *getPassName() const {
     return "Mandarin DAG->DAG Pattern Instruction Selection";
@@ -53,9 +59,104 @@ public:
 #include "MandarinGenDAGISel.inc"
 
 private:
+  SDValue getPair64(SDValue Lo, SDValue Hi, SDLoc dl);
 };
 }  // end anonymous namespace
 
+/// getPair64 - Build an i64 DoubleRegs pair from its 32-bit halves.
+SDValue MandarinDAGToDAGISel::getPair64(SDValue Lo, SDValue Hi, SDLoc dl)
+{
+	const SDValue Ops[] = {
+		CurDAG->getTargetConstant(MD::DoubleRegsRegClassID, MVT::i32),
+		Lo, CurDAG->getTargetConstant(MD::r2sub0, MVT::i32),
+		Hi, CurDAG->getTargetConstant(MD::r2sub1, MVT::i32)
+	};
+	return SDValue(CurDAG->getMachineNode(TargetOpcode::REG_SEQUENCE, dl,
+	                                      MVT::i64, Ops), 0);
+}
+
+/// PreprocessISelDAG - Split the i64 nodes the legalizer lets through, i64
+/// constants and extending loads / truncating stores between i64 and
+/// narrower memory, into their 32-bit halves.
+void MandarinDAGToDAGISel::PreprocessISelDAG()
+{
+	for (SelectionDAG::allnodes_iterator I = CurDAG->allnodes_begin(),
+	     E = CurDAG->allnodes_end(); I != E; )
+	{
+		SDNode *N = I++;  // Preincrement iterator to avoid invalidation issues.
+		SDLoc dl(N);
+
+		if (N->getOpcode() == ISD::Constant && N->getValueType(0) == MVT::i64)
+		{
+			uint64_t Val = cast<ConstantSDNode>(N)->getZExtValue();
+			SDValue Pair = getPair64(
+				CurDAG->getConstant(Val & 0xFFFFFFFF, MVT::i32),
+				CurDAG->getConstant(Val >> 32, MVT::i32), dl);
+			CurDAG->ReplaceAllUsesOfValueWith(SDValue(N, 0), Pair);
+			CurDAG->DeleteNode(N);
+			continue;
+		}
+
+		if (LoadSDNode *LD = dyn_cast<LoadSDNode>(N))
+		{
+			if (LD->getValueType(0) != MVT::i64 ||
+			    LD->getExtensionType() == ISD::NON_EXTLOAD)
+				continue;
+
+			EVT MemVT = LD->getMemoryVT();
+			ISD::LoadExtType ExtType = MemVT == MVT::i32 ? ISD::NON_EXTLOAD
+			                                             : LD->getExtensionType();
+			SDValue Lo = CurDAG->getLoad(ISD::UNINDEXED, ExtType, MVT::i32, dl,
+			                             LD->getChain(), LD->getBasePtr(),
+			                             LD->getOffset(), MemVT,
+			                             LD->getMemOperand());
+
+			SDValue Hi;
+			switch (LD->getExtensionType()) {
+			default:
+				llvm_unreachable("Unexpected load extension!");
+			case ISD::EXTLOAD:
+				Hi = CurDAG->getUNDEF(MVT::i32);
+				break;
+			case ISD::ZEXTLOAD:
+				Hi = CurDAG->getConstant(0, MVT::i32);
+				break;
+			case ISD::SEXTLOAD:
+				// -(lo >> 31), there is no arithmetic shift.
+				Hi = CurDAG->getNode(ISD::SUB, dl, MVT::i32,
+					CurDAG->getConstant(0, MVT::i32),
+					CurDAG->getNode(ISD::SRL, dl, MVT::i32, Lo,
+					                CurDAG->getConstant(31, MVT::i32)));
+				break;
+			}
+
+			CurDAG->ReplaceAllUsesOfValueWith(SDValue(N, 0), getPair64(Lo, Hi, dl));
+			CurDAG->ReplaceAllUsesOfValueWith(SDValue(N, 1), Lo.getValue(1));
+			CurDAG->DeleteNode(N);
+			continue;
+		}
+
+		if (StoreSDNode *ST = dyn_cast<StoreSDNode>(N))
+		{
+			if (ST->getValue().getValueType() != MVT::i64 || !ST->isTruncatingStore())
+				continue;
+
+			EVT MemVT = ST->getMemoryVT();
+			SDValue Lo = CurDAG->getTargetExtractSubreg(MD::r2sub0, dl, MVT::i32,
+			                                            ST->getValue());
+			SDValue NewST = MemVT == MVT::i32 ?
+				CurDAG->getStore(ST->getChain(), dl, Lo, ST->getBasePtr(),
+				                 ST->getMemOperand()) :
+				CurDAG->getTruncStore(ST->getChain(), dl, Lo, ST->getBasePtr(),
+				                      MemVT, ST->getMemOperand());
+
+			CurDAG->ReplaceAllUsesOfValueWith(SDValue(N, 0), NewST);
+			CurDAG->DeleteNode(N);
+			continue;
+		}
+	}
+}
+
 SDNode *MandarinDAGToDAGISel::Select(SDNode *N) {
   SDLoc dl(N);
   if (N->isMachineOpcode()) {
@@ -68,14 +169,88 @@ SDNode *MandarinDAGToDAGISel::Select(SDNode *N) {
   case ISD::FrameIndex:
 	  if (FrameIndexSDNode *FIN = dyn_cast<FrameIndexSDNode>(N))
 	  {
-		  return CurDAG->getTargetFrameIndex(FIN->getIndex(),
-			  getTargetLowering()->getPointerTy()).getNode();
+		  // The address of a stack object is formed as FI + 0, the frame index
+		  // elimination folds the real offset into the immediate.
+		  EVT VT = getTargetLowering()->getPointerTy();
+		  SDValue TFI = CurDAG->getTargetFrameIndex(FIN->getIndex(), VT);
+		  return CurDAG->SelectNodeTo(N, MD::ADDri, VT, TFI,
+		                              CurDAG->getTargetConstant(0, MVT::i32));
 	  }
+	  break;
+  case ISD::Constant:
+	  if (N->getValueType(0) == MVT::i32)
+		  if (SDNode *ResNode = SelectImmediate(N))
+			  return ResNode;
+	  break;
   }
 
   return SelectCode(N);
 }
 
+/// SelectImmediate - Materialize an i32 constant with the sequence chosen by
+/// MandarinTargetLowering::getIntImmKind. Plain ldi is left to the patterns.
+SDNode *MandarinDAGToDAGISel::SelectImmediate(SDNode *N)
+{
+	SDLoc dl(N);
+	uint32_t Imm = (uint32_t)cast<ConstantSDNode>(N)->getZExtValue();
+	uint32_t Val;
+	unsigned Shift;
+
+	const MandarinTargetLowering *TLI =
+		static_cast<const MandarinTargetLowering*>(getTargetLowering());
+	MDImm::Kind Kind = TLI->getIntImmKind(Imm, Val, Shift);
+
+	if (Kind == MDImm::LDI)
+		return NULL;
+
+	if (Kind == MDImm::CONSTPOOL)
+	{
+		MachineFunction &MF = CurDAG->getMachineFunction();
+		const Constant *C = ConstantInt::get(
+			Type::getInt32Ty(*CurDAG->getContext()), Imm);
+		SDValue CPI = CurDAG->getTargetConstantPool(C, TLI->getPointerTy(), 4, 0,
+		                                            MDII::MO_LO16);
+		MachineSDNode *Load = CurDAG->getMachineNode(MD::LOADri, dl, MVT::i32,
+		                                             MVT::Other, CPI,
+		                                             CurDAG->getEntryNode());
+
+		MachineSDNode::mmo_iterator MemOp = MF.allocateMemRefsArray(1);
+		MemOp[0] = MF.getMachineMemOperand(MachinePointerInfo::getConstantPool(),
+		                                   MachineMemOperand::MOLoad, 4, 4);
+		Load->setMemRefs(MemOp, MemOp + 1);
+
+		ReplaceUses(SDValue(N, 0), SDValue(Load, 0));
+		return NULL;
+	}
+
+	if (Kind == MDImm::LDI_HI_LO)
+	{
+		SDNode *Lo = CurDAG->getMachineNode(MD::LDIri, dl, MVT::i32,
+			CurDAG->getTargetConstant(Imm & 0x7FFFF, MVT::i32));
+		SDNode *Hi = CurDAG->getMachineNode(MD::LDIri, dl, MVT::i32,
+			CurDAG->getTargetConstant(Imm >> 19, MVT::i32));
+		Hi = CurDAG->getMachineNode(MD::SHLri, dl, MVT::i32, SDValue(Hi, 0),
+			CurDAG->getTargetConstant(19, MVT::i32));
+		return CurDAG->SelectNodeTo(N, MD::ORrr, MVT::i32, SDValue(Lo, 0),
+		                            SDValue(Hi, 0));
+	}
+
+	SDValue Res = SDValue(CurDAG->getMachineNode(MD::LDIri, dl, MVT::i32,
+		CurDAG->getTargetConstant(Val, MVT::i32)), 0);
+
+	if (Kind == MDImm::NOT)
+		return CurDAG->SelectNodeTo(N, MD::NOTrr, MVT::i32, Res);
+
+	if (Kind == MDImm::SHL)
+		return CurDAG->SelectNodeTo(N, MD::SHLri, MVT::i32, Res,
+		                            CurDAG->getTargetConstant(Shift, MVT::i32));
+
+	assert(Kind == MDImm::NOT_SHL && "Unknown immediate kind");
+	Res = SDValue(CurDAG->getMachineNode(MD::SHLri, dl, MVT::i32, Res,
+		CurDAG->getTargetConstant(Shift, MVT::i32)), 0);
+	return CurDAG->SelectNodeTo(N, MD::NOTrr, MVT::i32, Res);
+}
+
 bool MandarinDAGToDAGISel::SelectAddr(SDValue Addr, SDValue &R1)
 {
 	if (FrameIndexSDNode *FIN = dyn_cast<FrameIndexSDNode>(Addr))
@@ -96,6 +271,88 @@ bool MandarinDAGToDAGISel::SelectAddr(SDValue Addr, SDValue &R1)
 	return true;
 }
 
+/// SelectAddrRI - Match a base register plus a signed 14-bit displacement.
+/// Plain register addresses are left to SelectAddr.
+bool MandarinDAGToDAGISel::SelectAddrRI(SDValue Addr, SDValue &Base,
+                                        SDValue &Offset)
+{
+	EVT PtrVT = getTargetLowering()->getPointerTy();
+
+	if (FrameIndexSDNode *FIN = dyn_cast<FrameIndexSDNode>(Addr))
+	{
+		Base = CurDAG->getTargetFrameIndex(FIN->getIndex(), PtrVT);
+		Offset = CurDAG->getTargetConstant(0, MVT::i32);
+		return true;
+	}
+
+	// ISD::OR is accepted as well when the constant bits are known to be zero
+	// in the base (aligned struct fields, array elements).
+	if (!CurDAG->isBaseWithConstantOffset(Addr))
+		return false;
+
+	int64_t Disp = cast<ConstantSDNode>(Addr.getOperand(1))->getSExtValue();
+	if (!isInt<14>(Disp))
+		return false;
+
+	if (FrameIndexSDNode *FIN = dyn_cast<FrameIndexSDNode>(Addr.getOperand(0)))
+		Base = CurDAG->getTargetFrameIndex(FIN->getIndex(), PtrVT);
+	else
+		Base = Addr.getOperand(0);
+
+	Offset = CurDAG->getTargetConstant(Disp, MVT::i32);
+	return true;
+}
+
+/// SelectAddrImm - Match an address that fits into the immediate field of
+/// the absolute load/store forms: MDISD::LOW of a global or a constant pool
+/// entry, optionally plus a constant, or a small constant address.
+bool MandarinDAGToDAGISel::SelectAddrImm(SDValue Addr, SDValue &Imm)
+{
+	if (ConstantSDNode *CN = dyn_cast<ConstantSDNode>(Addr))
+	{
+		if (!isUInt<19>(CN->getZExtValue()))
+			return false;
+
+		Imm = CurDAG->getTargetConstant(CN->getZExtValue(), MVT::i32);
+		return true;
+	}
+
+	int64_t Disp = 0;
+	if (Addr.getOpcode() == ISD::ADD && isa<ConstantSDNode>(Addr.getOperand(1)))
+	{
+		Disp = cast<ConstantSDNode>(Addr.getOperand(1))->getSExtValue();
+		Addr = Addr.getOperand(0);
+	}
+
+	if (Addr.getOpcode() != MDISD::LOW)
+		return false;
+
+	SDValue Sym = Addr.getOperand(0);
+	SDLoc dl(Addr);
+
+	if (GlobalAddressSDNode *GA = dyn_cast<GlobalAddressSDNode>(Sym))
+	{
+		Imm = CurDAG->getTargetGlobalAddress(GA->getGlobal(), dl, MVT::i32,
+		                                     GA->getOffset() + Disp,
+		                                     GA->getTargetFlags());
+		return true;
+	}
+
+	if (ConstantPoolSDNode *CP = dyn_cast<ConstantPoolSDNode>(Sym))
+	{
+		if (CP->isMachineConstantPoolEntry())
+			return false;
+
+		Imm = CurDAG->getTargetConstantPool(CP->getConstVal(), MVT::i32,
+		                                    CP->getAlignment(),
+		                                    CP->getOffset() + Disp,
+		                                    CP->getTargetFlags());
+		return true;
+	}
+
+	return false;
+}
+
 /// createMandarinISelDag - This pass converts a legalized DAG into a
 /// Mandarin-specific DAG, ready for instruction scheduling.
 ///
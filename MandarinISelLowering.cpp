@@ -23,6 +23,7 @@
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/SelectionDAG.h"
 #include "llvm/CodeGen/TargetLoweringObjectFileImpl.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
@@ -31,22 +32,6 @@ using namespace llvm;
 
 #include "MandarinGenCallingConv.inc"
 
-/// For each argument in a function store the number of pieces it is composed
-/// of.
-template<typename ArgT>
-static void ParseFunctionArgs(const SmallVectorImpl<ArgT> &Args,
-                              SmallVectorImpl<unsigned> &Out) {
-  unsigned CurrentArgIndex = ~0U;
-  for (unsigned i = 0, e = Args.size(); i != e; i++) {
-    if (CurrentArgIndex == Args[i].OrigArgIndex) {
-      Out.back()++;
-    } else {
-      Out.push_back(1);
-      CurrentArgIndex++;
-    }
-  }
-}
-
 static void AnalyzeVarArgs(CCState &State,
                            const SmallVectorImpl<ISD::OutputArg> &Outs) {
   State.AnalyzeCallOperands(Outs, CC_Mandarin_AssignStack);
@@ -57,65 +42,39 @@ static void AnalyzeVarArgs(CCState &State,
   State.AnalyzeFormalArguments(Ins, CC_Mandarin_AssignStack);
 }
 
+static void AnalyzeFixedArgs(CCState &State,
+                             const SmallVectorImpl<ISD::OutputArg> &Outs) {
+  State.AnalyzeCallOperands(Outs, State.getCallingConv() == CallingConv::Fast ?
+                                  CC_Mandarin_Fast : CC_Mandarin);
+}
+
+static void AnalyzeFixedArgs(CCState &State,
+                             const SmallVectorImpl<ISD::InputArg> &Ins) {
+  State.AnalyzeFormalArguments(Ins, State.getCallingConv() == CallingConv::Fast ?
+                                    CC_Mandarin_Fast : CC_Mandarin);
+}
+
+/// getEffectiveCallConv - Local functions whose address is never taken are
+/// only reached through direct calls in this module, those use the fast
+/// convention whatever the function was declared with.
+static CallingConv::ID getEffectiveCallConv(const Function *F,
+                                            CallingConv::ID CC) {
+  if (CC == CallingConv::C && F && F->hasLocalLinkage() &&
+      !F->isVarArg() && !F->hasAddressTaken())
+    return CallingConv::Fast;
+  return CC;
+}
+
 template<typename ArgT>
 static void AnalyzeArguments(CCState &State,
                              SmallVectorImpl<CCValAssign> &ArgLocs,
                              const SmallVectorImpl<ArgT> &Args) {
-  static const uint16_t RegList[] = {
-    MD::R0, MD::R1, MD::R2, MD::R3
-  };
-  static const unsigned NbRegs = array_lengthof(RegList);
-
   if (State.isVarArg()) {
     AnalyzeVarArgs(State, Args);
     return;
   }
 
-  SmallVector<unsigned, 4> ArgsParts;
-  ParseFunctionArgs(Args, ArgsParts);
-
-  unsigned RegsLeft = NbRegs;
-  bool UseStack = false;
-  unsigned ValNo = 0;
-
-  for (unsigned i = 0, e = ArgsParts.size(); i != e; i++) {
-    MVT ArgVT = Args[ValNo].VT;
-    ISD::ArgFlagsTy ArgFlags = Args[ValNo].Flags;
-    MVT LocVT = ArgVT;
-    CCValAssign::LocInfo LocInfo = CCValAssign::Full;
-
-    // Handle byval arguments
-    if (ArgFlags.isByVal()) {
-      State.HandleByVal(ValNo++, ArgVT, LocVT, LocInfo, 2, 2, ArgFlags);
-      continue;
-    }
-
-    unsigned Parts = ArgsParts[i];
-
-    if (!UseStack && Parts <= RegsLeft) {
-      unsigned FirstVal = ValNo;
-      for (unsigned j = 0; j < Parts; j++) {
-        unsigned Reg = State.AllocateReg(RegList, NbRegs);
-        State.addLoc(CCValAssign::getReg(ValNo++, ArgVT, Reg, LocVT, LocInfo));
-        RegsLeft--;
-      }
-    } else {
-      UseStack = true;
-      for (unsigned j = 0; j < Parts; j++)
-	  {
-		  if (ArgFlags.isByVal()) {
-			State.HandleByVal(ValNo++, ArgVT, LocVT, LocInfo, 4, 4, ArgFlags);
-			continue;
-		  }
-
-		  if (LocVT == MVT::i32 || LocVT == MVT::f32) {
-			unsigned Offset1 = State.AllocateStack(4, 4);
-			State.addLoc(CCValAssign::getMem(ValNo++, ArgVT, Offset1, LocVT, LocInfo));
-			continue;
-		  }
-	  }
-    }
-  }
+  AnalyzeFixedArgs(State, Args);
 }
 
 SDValue
@@ -125,6 +84,7 @@ MandarinTargetLowering::LowerReturn(SDValue Chain,
                                  const SmallVectorImpl<SDValue> &OutVals,
                                  SDLoc DL, SelectionDAG &DAG) const {
   MachineFunction &MF = DAG.getMachineFunction();
+  CallConv = getEffectiveCallConv(MF.getFunction(), CallConv);
 
   // CCValAssign - represent the assignment of the return value to locations.
   SmallVector<CCValAssign, 16> RVLocs;
@@ -134,7 +94,8 @@ MandarinTargetLowering::LowerReturn(SDValue Chain,
                  DAG.getTarget(), RVLocs, *DAG.getContext());
 
   // Analyze return values.
-  CCInfo.AnalyzeReturn(Outs, RetCC_Mandarin);
+  CCInfo.AnalyzeReturn(Outs, CallConv == CallingConv::Fast ?
+                             RetCC_Mandarin_Fast : RetCC_Mandarin);
 
   SDValue Flag;
   SmallVector<SDValue, 4> RetOps(1, Chain);
@@ -174,6 +135,7 @@ LowerFormalArguments(SDValue Chain,
   MachineFrameInfo *MFI = MF.getFrameInfo();
   MachineRegisterInfo &RegInfo = MF.getRegInfo();
   MandarinMachineFunctionInfo *FuncInfo = MF.getInfo<MandarinMachineFunctionInfo>();
+  CallConv = getEffectiveCallConv(MF.getFunction(), CallConv);
 
   /*printf("LowerFormalArguments()\n");
   printf("CallConv %d\n", CallConv);
@@ -201,6 +163,8 @@ LowerFormalArguments(SDValue Chain,
                  getTargetMachine(), ArgLocs, *DAG.getContext());
   AnalyzeArguments(CCInfo, ArgLocs, Ins);
 
+  FuncInfo->setIncomingArgSize(CCInfo.getNextStackOffset());
+
   /*printf("ArgLocs size %d\n", ArgLocs.size());
   for(unsigned i = 0; i < ArgLocs.size(); i++)
   {
@@ -235,6 +199,8 @@ LowerFormalArguments(SDValue Chain,
 
         InVals.push_back(ArgValue);
 		break;
+	  case MVT::i64:
+	  case MVT::f64:
 	  case MVT::v2i32:
 	  case MVT::v2f32:
         VReg = RegInfo.createVirtualRegister(&MD::DoubleRegsRegClass);
@@ -249,6 +215,14 @@ LowerFormalArguments(SDValue Chain,
         RegInfo.addLiveIn(VA.getLocReg(), VReg);
         ArgValue = DAG.getCopyFromReg(Chain, DL, VReg, RegVT);
 
+        InVals.push_back(ArgValue);
+		break;
+	  case MVT::v8i32:
+	  case MVT::v8f32:
+        VReg = RegInfo.createVirtualRegister(&MD::OctRegsRegClass);
+        RegInfo.addLiveIn(VA.getLocReg(), VReg);
+        ArgValue = DAG.getCopyFromReg(Chain, DL, VReg, RegVT);
+
         InVals.push_back(ArgValue);
 		break;
       }
@@ -265,12 +239,11 @@ LowerFormalArguments(SDValue Chain,
         InVal = DAG.getFrameIndex(FI, getPointerTy());
       } else {
         // Load the argument to a virtual register
-        unsigned ObjSize = VA.getLocVT().getSizeInBits() / 32;
-        if (ObjSize > 1) {
-            llvm_unreachable(0);
-        }
+        unsigned ObjSize = VA.getLocVT().getStoreSize();
         // Create the frame index object for this incoming parameter...
-        int FI = MFI->CreateFixedObject(ObjSize, VA.getLocMemOffset(), true);
+        // Guaranteed tail calls overwrite it with their own arguments.
+        int FI = MFI->CreateFixedObject(ObjSize, VA.getLocMemOffset(),
+                                        !getTargetMachine().Options.GuaranteedTailCallOpt);
 
         // Create the SelectionDAG nodes corresponding to a load
         // from this parameter
@@ -301,8 +274,12 @@ MandarinTargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
   CallingConv::ID CallConv              = CLI.CallConv;
   bool isVarArg                         = CLI.IsVarArg;
 
-  // Mandarin target does not yet support tail call optimization.
-  isTailCall = false;
+  MachineFunction &MF = DAG.getMachineFunction();
+
+  const Function *CalleeFn = 0;
+  if (GlobalAddressSDNode *G = dyn_cast<GlobalAddressSDNode>(Callee))
+    CalleeFn = dyn_cast<Function>(G->getGlobal());
+  CallConv = getEffectiveCallConv(CalleeFn, CallConv);
 
   // functions arguments are copied from virtual regs to (physical regs)/(stack frame)
   // CALLSEQ_START and CALLSEQ_END are emitted.
@@ -310,14 +287,30 @@ MandarinTargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
 
   // Analyze operands of the call, assigning locations to each operand.
   SmallVector<CCValAssign, 16> ArgLocs;
-  CCState CCInfo(CallConv, isVarArg, DAG.getMachineFunction(),
+  CCState CCInfo(CallConv, isVarArg, MF,
                  getTargetMachine(), ArgLocs, *DAG.getContext());
   AnalyzeArguments(CCInfo, ArgLocs, Outs);
 
+  if (getTargetMachine().Options.DisableTailCalls)
+    isTailCall = false;
+
+  if (isTailCall)
+    isTailCall = IsEligibleForTailCallOptimization(CCInfo, CallConv, isVarArg,
+                                                   Outs, OutVals, ArgLocs, DAG);
+
+  // Sibling calls only pass incoming stack arguments through, guaranteed tail
+  // calls store them over the incoming argument area.
+  bool StoreStackArgs = !isTailCall ||
+    getTargetMachine().Options.GuaranteedTailCallOpt;
+
   // Get a count of how many bytes are to be pushed on the stack.
   unsigned NumBytes = CCInfo.getNextStackOffset();
 
-  Chain = DAG.getCALLSEQ_START(Chain ,DAG.getConstant(NumBytes, getPointerTy(), true), dl);
+  if (!isTailCall)
+    Chain = DAG.getCALLSEQ_START(Chain ,DAG.getConstant(NumBytes, getPointerTy(), true), dl);
+  else if (NumBytes)
+    // All incoming stack arguments must be loaded before they are overwritten.
+    Chain = DAG.getStackArgumentTokenFactor(Chain);
 
   SmallVector<std::pair<unsigned, SDValue>, 4> RegsToPass;
   SmallVector<SDValue, 12> MemOpChains;
@@ -348,6 +341,19 @@ MandarinTargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
     // vector
     if (VA.isRegLoc()) {
       RegsToPass.push_back(std::make_pair(VA.getLocReg(), Arg));
+    } else if (isTailCall) {
+      assert(VA.isMemLoc());
+
+      if (!StoreStackArgs)
+        continue;
+
+      // The callee finds its arguments where ours were.
+      int FI = MF.getFrameInfo()->CreateFixedObject(VA.getLocVT().getStoreSize(),
+                                                    VA.getLocMemOffset(), false);
+      SDValue FIN = DAG.getFrameIndex(FI, getPointerTy());
+      MemOpChains.push_back(DAG.getStore(Chain, dl, Arg, FIN,
+                                         MachinePointerInfo::getFixedStack(FI),
+                                         false, false, 0));
     } else {
       assert(VA.isMemLoc());
 
@@ -414,9 +420,25 @@ MandarinTargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
     Ops.push_back(DAG.getRegister(RegsToPass[i].first,
                                   RegsToPass[i].second.getValueType()));
 
+  // The call clobbers what the calling convention doesn't preserve. A callee
+  // that can't be replaced at link time may have left more registers alone.
+  const MandarinRegisterInfo *TRI =
+    static_cast<const MandarinRegisterInfo *>(getTargetMachine().getRegisterInfo());
+  const uint32_t *Mask;
+  if (CalleeFn && !CalleeFn->mayBeOverridden())
+    Mask = TRI->getCallPreservedMask(CalleeFn, CallConv);
+  else
+    Mask = TRI->getCallPreservedMask(CallConv);
+  Ops.push_back(DAG.getRegisterMask(Mask));
+
   if (InFlag.getNode())
     Ops.push_back(InFlag);
 
+  // The tail call is the terminator of the block, the callee returns straight
+  // to our caller.
+  if (isTailCall)
+    return DAG.getNode(MDISD::TAIL_CALL, dl, MVT::Other, &Ops[0], Ops.size());
+
   Chain = DAG.getNode(MDISD::CALL, dl, NodeTys, &Ops[0], Ops.size());
   InFlag = Chain.getValue(1);
 
@@ -433,14 +455,98 @@ MandarinTargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
                          DAG, InVals);
 }
 
+/// IsEligibleForTailCallOptimization - Check whether the call can be turned
+/// into a jump. The callee must return the same way the caller does and its
+/// stack arguments must fit into the caller's incoming argument area, which
+/// is the only part of the caller's frame the callee may take over.
+bool MandarinTargetLowering::IsEligibleForTailCallOptimization(
+                                     CCState &CCInfo,
+                                     CallingConv::ID CalleeCC,
+                                     bool isVarArg,
+                                     const SmallVectorImpl<ISD::OutputArg> &Outs,
+                                     const SmallVectorImpl<SDValue> &OutVals,
+                                     const SmallVectorImpl<CCValAssign> &ArgLocs,
+                                     SelectionDAG &DAG) const {
+  MachineFunction &MF = DAG.getMachineFunction();
+  const Function *CallerF = MF.getFunction();
+
+  if (getEffectiveCallConv(CallerF, CallerF->getCallingConv()) != CalleeCC)
+    return false;
+
+  if (isVarArg || CallerF->isVarArg())
+    return false;
+
+  // The sret pointer has to be returned by the caller itself.
+  if (CallerF->hasStructRetAttr())
+    return false;
+
+  for (unsigned i = 0, e = Outs.size(); i != e; ++i)
+    if (Outs[i].Flags.isByVal() || Outs[i].Flags.isSRet())
+      return false;
+
+  unsigned StackBytes = CCInfo.getNextStackOffset();
+  if (StackBytes == 0)
+    return true;
+
+  MandarinMachineFunctionInfo *FuncInfo = MF.getInfo<MandarinMachineFunctionInfo>();
+  if (StackBytes > FuncInfo->getIncomingArgSize())
+    return false;
+
+  // Guaranteed tail calls store their arguments over the incoming ones.
+  if (getTargetMachine().Options.GuaranteedTailCallOpt)
+    return true;
+
+  // A sibling call may only pass incoming stack arguments through unchanged,
+  // the incoming argument slots are immutable otherwise.
+  const MachineFrameInfo *MFI = MF.getFrameInfo();
+  for (unsigned i = 0, e = ArgLocs.size(); i != e; ++i) {
+    const CCValAssign &VA = ArgLocs[i];
+    if (VA.isRegLoc())
+      continue;
+
+    if (VA.getLocInfo() != CCValAssign::Full)
+      return false;
+
+    const LoadSDNode *Ld = dyn_cast<LoadSDNode>(OutVals[i]);
+    if (!Ld)
+      return false;
+
+    const FrameIndexSDNode *FIN = dyn_cast<FrameIndexSDNode>(Ld->getBasePtr());
+    if (!FIN || !MFI->isFixedObjectIndex(FIN->getIndex()))
+      return false;
+
+    if (MFI->getObjectOffset(FIN->getIndex()) != VA.getLocMemOffset() ||
+        Ld->getMemoryVT() != VA.getLocVT())
+      return false;
+  }
+
+  return true;
+}
+
 static void AnalyzeRetResult(CCState &State,
                              const SmallVectorImpl<ISD::InputArg> &Ins) {
-  State.AnalyzeCallResult(Ins, RetCC_Mandarin);
+  State.AnalyzeCallResult(Ins, State.getCallingConv() == CallingConv::Fast ?
+                               RetCC_Mandarin_Fast : RetCC_Mandarin);
 }
 
 static void AnalyzeRetResult(CCState &State,
                              const SmallVectorImpl<ISD::OutputArg> &Outs) {
-  State.AnalyzeReturn(Outs, RetCC_Mandarin);
+  State.AnalyzeReturn(Outs, State.getCallingConv() == CallingConv::Fast ?
+                            RetCC_Mandarin_Fast : RetCC_Mandarin);
+}
+
+/// CanLowerReturn - Results that don't fit the return registers are demoted
+/// to an sret argument. The callee of a call isn't known here, so local
+/// functions only given the fast convention by getEffectiveCallConv keep the
+/// C limit, both lists assign those values the same registers.
+bool MandarinTargetLowering::
+CanLowerReturn(CallingConv::ID CallConv, MachineFunction &MF, bool isVarArg,
+               const SmallVectorImpl<ISD::OutputArg> &Outs,
+               LLVMContext &Context) const {
+  SmallVector<CCValAssign, 16> RVLocs;
+  CCState CCInfo(CallConv, isVarArg, MF, getTargetMachine(), RVLocs, Context);
+  return CCInfo.CheckReturn(Outs, CallConv == CallingConv::Fast ?
+                                  RetCC_Mandarin_Fast : RetCC_Mandarin);
 }
 
 template<typename ArgT>
@@ -487,7 +593,6 @@ MandarinTargetLowering::LowerCallResult(SDValue Chain, SDValue InFlag,
 static MDCC::CondCodes DAGIntCCToMDCC(ISD::CondCode CC) {
   switch (CC) {
   default:
-	  // TODO: should return signed/unsigned operation flag
 	  llvm_unreachable("Unknown integer condition code!");
   case ISD::SETEQ:  return MDCC::COND_EQ;
   case ISD::SETNE:  return MDCC::COND_NE;
@@ -495,6 +600,10 @@ static MDCC::CondCodes DAGIntCCToMDCC(ISD::CondCode CC) {
   case ISD::SETGT:  return MDCC::COND_GR;
   case ISD::SETLE:  return MDCC::COND_LE;
   case ISD::SETGE:  return MDCC::COND_GE;
+  case ISD::SETULT: return MDCC::COND_ULS;
+  case ISD::SETUGT: return MDCC::COND_UGR;
+  case ISD::SETULE: return MDCC::COND_ULE;
+  case ISD::SETUGE: return MDCC::COND_UGE;
   }
 }
 
@@ -525,10 +634,14 @@ MandarinTargetLowering::MandarinTargetLowering(TargetMachine &TM)
   // Set up the register classes.
   addRegisterClass(MVT::i32, &MD::GenericRegsRegClass);
   addRegisterClass(MVT::f32, &MD::GenericRegsRegClass);
+  addRegisterClass(MVT::i64, &MD::DoubleRegsRegClass);
+  addRegisterClass(MVT::f64, &MD::DoubleRegsRegClass);
   addRegisterClass(MVT::v2i32, &MD::DoubleRegsRegClass);
   addRegisterClass(MVT::v2f32, &MD::DoubleRegsRegClass);
   addRegisterClass(MVT::v4i32, &MD::QuadRegsRegClass);
   addRegisterClass(MVT::v4f32, &MD::QuadRegsRegClass);
+  addRegisterClass(MVT::v8i32, &MD::OctRegsRegClass);
+  addRegisterClass(MVT::v8f32, &MD::OctRegsRegClass);
 
   setLoadExtAction(ISD::EXTLOAD, MVT::f32, Expand);
   setLoadExtAction(ISD::EXTLOAD, MVT::f64, Expand);
@@ -544,32 +657,60 @@ MandarinTargetLowering::MandarinTargetLowering(TargetMachine &TM)
 
   setOperationAction(ISD::GlobalAddress, getPointerTy(), Custom);
   setOperationAction(ISD::ConstantPool, getPointerTy(), Custom);
-  //setOperationAction(ISD::BlockAddress, getPointerTy(), Custom);
+  setOperationAction(ISD::JumpTable, getPointerTy(), Custom);
+  setOperationAction(ISD::BlockAddress, getPointerTy(), Custom);
 
-  setOperationAction(ISD::SIGN_EXTEND_INREG, MVT::i16, Expand);
-  setOperationAction(ISD::SIGN_EXTEND_INREG, MVT::i8 , Expand);
-  setOperationAction(ISD::SIGN_EXTEND_INREG, MVT::i1 , Expand);
+  // No arithmetic shift, sign extensions are done with xor/sub.
+  setOperationAction(ISD::SIGN_EXTEND_INREG, MVT::i16, Custom);
+  setOperationAction(ISD::SIGN_EXTEND_INREG, MVT::i8 , Custom);
+  setOperationAction(ISD::SIGN_EXTEND_INREG, MVT::i1 , Custom);
 
-  setOperationAction(ISD::UDIV, MVT::i32, Expand);
-  setOperationAction(ISD::UREM, MVT::i32, Expand);
+  // Unsigned division is built from the signed one.
+  setOperationAction(ISD::UDIV, MVT::i32, Custom);
+  setOperationAction(ISD::UREM, MVT::i32, Custom);
   setOperationAction(ISD::SDIVREM, MVT::i32, Expand);
-  setOperationAction(ISD::UDIVREM, MVT::i32, Expand);
-
-  setOperationAction(ISD::FP_TO_UINT, MVT::i32, Expand);
-  setOperationAction(ISD::UINT_TO_FP, MVT::i32, Expand);
-
-  setOperationAction(ISD::BITCAST, MVT::f32, Expand);
-  setOperationAction(ISD::BITCAST, MVT::i32, Expand);
+  setOperationAction(ISD::UDIVREM, MVT::i32, Custom);
+
+  // f32 <-> i32 unsigned conversions are built from the signed ones, f64
+  // ones are libcalls.
+  setOperationAction(ISD::FP_TO_SINT, MVT::i32, Custom);
+  setOperationAction(ISD::FP_TO_UINT, MVT::i32, Custom);
+  setOperationAction(ISD::SINT_TO_FP, MVT::i32, Custom);
+  setOperationAction(ISD::UINT_TO_FP, MVT::i32, Custom);
+
+  // Bitcasts within a register class are free.
+  setOperationAction(ISD::BITCAST, MVT::f32, Legal);
+  setOperationAction(ISD::BITCAST, MVT::i32, Legal);
+  setOperationAction(ISD::BITCAST, MVT::v2f32, Legal);
+  setOperationAction(ISD::BITCAST, MVT::v2i32, Legal);
+  setOperationAction(ISD::BITCAST, MVT::v4f32, Legal);
+  setOperationAction(ISD::BITCAST, MVT::v4i32, Legal);
+  setOperationAction(ISD::BITCAST, MVT::v8f32, Legal);
+  setOperationAction(ISD::BITCAST, MVT::v8i32, Legal);
+
+  // There are no float sign instructions, operate on the sign bit.
+  setOperationAction(ISD::FABS, MVT::f32, Custom);
+  setOperationAction(ISD::FNEG, MVT::f32, Custom);
+  setOperationAction(ISD::FABS, MVT::v2f32, Expand);
+  setOperationAction(ISD::FNEG, MVT::v2f32, Expand);
+  setOperationAction(ISD::FCOPYSIGN, MVT::v2f32, Expand);
+  setOperationAction(ISD::FABS, MVT::v4f32, Expand);
+  setOperationAction(ISD::FNEG, MVT::v4f32, Expand);
+  setOperationAction(ISD::FCOPYSIGN, MVT::v4f32, Expand);
+  setOperationAction(ISD::FABS, MVT::v8f32, Expand);
+  setOperationAction(ISD::FNEG, MVT::v8f32, Expand);
+  setOperationAction(ISD::FCOPYSIGN, MVT::v8f32, Expand);
 
   setOperationAction(ISD::SELECT, MVT::i32, Expand);
   setOperationAction(ISD::SELECT, MVT::f32, Expand);
 
-  setOperationAction(ISD::SETCC, MVT::i32, Expand);
-  setOperationAction(ISD::SETCC, MVT::f32, Expand);
+  setOperationAction(ISD::SETCC, MVT::i32, Custom);
+  setOperationAction(ISD::SETCC, MVT::f32, Custom);
 
+  // Jump tables are loaded with a plain load and dispatched with JMPr.
   setOperationAction(ISD::BRCOND, MVT::Other, Expand);
-  setOperationAction(ISD::BRIND, MVT::Other, Expand);
   setOperationAction(ISD::BR_JT, MVT::Other, Expand);
+  setSupportJumpTables(true);
 
   setOperationAction(ISD::BR_CC, MVT::i32, Custom);
   setOperationAction(ISD::BR_CC, MVT::f32, Custom);
@@ -599,13 +740,13 @@ MandarinTargetLowering::MandarinTargetLowering(TargetMachine &TM)
   setOperationAction(ISD::CTTZ_ZERO_UNDEF, MVT::i32, Expand);
   setOperationAction(ISD::CTLZ , MVT::i32, Expand);
   setOperationAction(ISD::CTLZ_ZERO_UNDEF, MVT::i32, Expand);
-  //setOperationAction(ISD::SRA  , MVT::i32, Expand);
+  setOperationAction(ISD::SRA  , MVT::i32, Custom);
   setOperationAction(ISD::ROTL , MVT::i32, Expand);
   setOperationAction(ISD::ROTR , MVT::i32, Expand);
   setOperationAction(ISD::BSWAP, MVT::i32, Expand);
   setOperationAction(ISD::FCOPYSIGN, MVT::f128, Expand);
-  setOperationAction(ISD::FCOPYSIGN, MVT::f64, Expand);
-  setOperationAction(ISD::FCOPYSIGN, MVT::f32, Expand);
+  setOperationAction(ISD::FCOPYSIGN, MVT::f64, Custom);
+  setOperationAction(ISD::FCOPYSIGN, MVT::f32, Custom);
   setOperationAction(ISD::FPOW , MVT::f128, Expand);
   setOperationAction(ISD::FPOW , MVT::f64, Expand);
   setOperationAction(ISD::FPOW , MVT::f32, Expand);
@@ -617,6 +758,84 @@ MandarinTargetLowering::MandarinTargetLowering(TargetMachine &TM)
   setOperationAction(ISD::UMUL_LOHI, MVT::i32, Expand);
   setOperationAction(ISD::SMUL_LOHI, MVT::i32, Expand);
 
+  // i64 lives in a DoubleRegs pair. and/or/xor work on both halves at once,
+  // the rest is done on the halves or in libcalls.
+  setOperationAction(ISD::ADD, MVT::i64, Custom);
+  setOperationAction(ISD::SUB, MVT::i64, Custom);
+  setOperationAction(ISD::SHL, MVT::i64, Custom);
+  setOperationAction(ISD::SRL, MVT::i64, Custom);
+  setOperationAction(ISD::SRA, MVT::i64, Custom);
+  setOperationAction(ISD::SETCC, MVT::i64, Custom);
+  setOperationAction(ISD::BR_CC, MVT::i64, Custom);
+  setOperationAction(ISD::SELECT_CC, MVT::i64, Custom);
+  setOperationAction(ISD::SELECT, MVT::i64, Expand);
+  setOperationAction(ISD::ZERO_EXTEND, MVT::i64, Custom);
+  setOperationAction(ISD::SIGN_EXTEND, MVT::i64, Custom);
+  setOperationAction(ISD::ANY_EXTEND, MVT::i64, Custom);
+  setOperationAction(ISD::SIGN_EXTEND_INREG, MVT::i32, Custom);
+  setOperationAction(ISD::BITCAST, MVT::i64, Legal);
+  setOperationAction(ISD::FP_TO_SINT, MVT::i64, Custom);
+  setOperationAction(ISD::FP_TO_UINT, MVT::i64, Custom);
+  setOperationAction(ISD::SINT_TO_FP, MVT::i64, Custom);
+  setOperationAction(ISD::UINT_TO_FP, MVT::i64, Custom);
+
+  // f64 is a storage type in a DoubleRegs pair. Arithmetic is done by the
+  // soft-float libcalls, which take and return it in RD pairs; sign
+  // operations work on the high word and compares on the libcall result.
+  setOperationAction(ISD::FADD, MVT::f64, Expand);
+  setOperationAction(ISD::FSUB, MVT::f64, Expand);
+  setOperationAction(ISD::FMUL, MVT::f64, Expand);
+  setOperationAction(ISD::FDIV, MVT::f64, Expand);
+  setOperationAction(ISD::FSQRT, MVT::f64, Expand);
+  setOperationAction(ISD::FABS, MVT::f64, Custom);
+  setOperationAction(ISD::FNEG, MVT::f64, Custom);
+  setOperationAction(ISD::SETCC, MVT::f64, Custom);
+  setOperationAction(ISD::BR_CC, MVT::f64, Custom);
+  setOperationAction(ISD::SELECT_CC, MVT::f64, Custom);
+  setOperationAction(ISD::SELECT, MVT::f64, Expand);
+  setOperationAction(ISD::FP_EXTEND, MVT::f64, Custom);
+  setOperationAction(ISD::FP_ROUND, MVT::f32, Custom);
+  setOperationAction(ISD::BITCAST, MVT::f64, Legal);
+
+  // Carries are computed with setcc, which is branchless.
+  setOperationAction(ISD::ADDC, MVT::i32, Expand);
+  setOperationAction(ISD::ADDE, MVT::i32, Expand);
+  setOperationAction(ISD::SUBC, MVT::i32, Expand);
+  setOperationAction(ISD::SUBE, MVT::i32, Expand);
+  setOperationAction(ISD::ADDC, MVT::i64, Expand);
+  setOperationAction(ISD::ADDE, MVT::i64, Expand);
+  setOperationAction(ISD::SUBC, MVT::i64, Expand);
+  setOperationAction(ISD::SUBE, MVT::i64, Expand);
+
+  setOperationAction(ISD::MUL, MVT::i64, Expand);
+  setOperationAction(ISD::MULHU, MVT::i64, Expand);
+  setOperationAction(ISD::MULHS, MVT::i64, Expand);
+  setOperationAction(ISD::UMUL_LOHI, MVT::i64, Expand);
+  setOperationAction(ISD::SMUL_LOHI, MVT::i64, Expand);
+  setOperationAction(ISD::SDIV, MVT::i64, Expand);
+  setOperationAction(ISD::UDIV, MVT::i64, Expand);
+  setOperationAction(ISD::SREM, MVT::i64, Expand);
+  setOperationAction(ISD::UREM, MVT::i64, Expand);
+  setOperationAction(ISD::SDIVREM, MVT::i64, Expand);
+  setOperationAction(ISD::UDIVREM, MVT::i64, Expand);
+  setOperationAction(ISD::SADDO, MVT::i64, Expand);
+  setOperationAction(ISD::UADDO, MVT::i64, Expand);
+  setOperationAction(ISD::SSUBO, MVT::i64, Expand);
+  setOperationAction(ISD::USUBO, MVT::i64, Expand);
+  setOperationAction(ISD::SMULO, MVT::i64, Expand);
+  setOperationAction(ISD::UMULO, MVT::i64, Expand);
+  setOperationAction(ISD::CTPOP, MVT::i64, Expand);
+  setOperationAction(ISD::CTTZ , MVT::i64, Expand);
+  setOperationAction(ISD::CTTZ_ZERO_UNDEF, MVT::i64, Expand);
+  setOperationAction(ISD::CTLZ , MVT::i64, Expand);
+  setOperationAction(ISD::CTLZ_ZERO_UNDEF, MVT::i64, Expand);
+  setOperationAction(ISD::ROTL , MVT::i64, Expand);
+  setOperationAction(ISD::ROTR , MVT::i64, Expand);
+  setOperationAction(ISD::BSWAP, MVT::i64, Expand);
+  setOperationAction(ISD::SHL_PARTS, MVT::i64, Expand);
+  setOperationAction(ISD::SRA_PARTS, MVT::i64, Expand);
+  setOperationAction(ISD::SRL_PARTS, MVT::i64, Expand);
+
   // VASTART needs to be custom lowered to use the VarArgsFrameIndex.
   setOperationAction(ISD::VASTART           , MVT::Other, Custom);
   // VAARG needs to be lowered to not do unaligned accesses for doubles.
@@ -629,23 +848,75 @@ MandarinTargetLowering::MandarinTargetLowering(TargetMachine &TM)
   setOperationAction(ISD::STACKRESTORE      , MVT::Other, Expand);
   setOperationAction(ISD::DYNAMIC_STACKALLOC, MVT::i32  , Custom);
 
-  setOperationAction(ISD::BUILD_VECTOR      , MVT::v2i32, Expand);
-  setOperationAction(ISD::BUILD_VECTOR      , MVT::v4i32, Expand);
-  setOperationAction(ISD::BUILD_VECTOR      , MVT::v2f32, Expand);
-  setOperationAction(ISD::BUILD_VECTOR      , MVT::v4f32, Expand);
-  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v2i32, Expand);
-  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v4i32, Expand);
-  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v2f32, Expand);
-  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v4f32, Expand);
-  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v2i32, Expand);
-  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v4i32, Expand);
-  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v2f32, Expand);
-  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v4f32, Expand);
+  // Vectors are assembled and permuted lane by lane in registers.
+  setOperationAction(ISD::BUILD_VECTOR      , MVT::v2i32, Custom);
+  setOperationAction(ISD::BUILD_VECTOR      , MVT::v4i32, Custom);
+  setOperationAction(ISD::BUILD_VECTOR      , MVT::v8i32, Custom);
+  setOperationAction(ISD::BUILD_VECTOR      , MVT::v2f32, Custom);
+  setOperationAction(ISD::BUILD_VECTOR      , MVT::v4f32, Custom);
+  setOperationAction(ISD::BUILD_VECTOR      , MVT::v8f32, Custom);
+  setOperationAction(ISD::SCALAR_TO_VECTOR  , MVT::v2i32, Custom);
+  setOperationAction(ISD::SCALAR_TO_VECTOR  , MVT::v4i32, Custom);
+  setOperationAction(ISD::SCALAR_TO_VECTOR  , MVT::v8i32, Custom);
+  setOperationAction(ISD::SCALAR_TO_VECTOR  , MVT::v2f32, Custom);
+  setOperationAction(ISD::SCALAR_TO_VECTOR  , MVT::v4f32, Custom);
+  setOperationAction(ISD::SCALAR_TO_VECTOR  , MVT::v8f32, Custom);
+  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v2i32, Custom);
+  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v4i32, Custom);
+  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v8i32, Custom);
+  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v2f32, Custom);
+  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v4f32, Custom);
+  setOperationAction(ISD::VECTOR_SHUFFLE    , MVT::v8f32, Custom);
+  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v2i32, Custom);
+  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v4i32, Custom);
+  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v8i32, Custom);
+  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v2f32, Custom);
+  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v4f32, Custom);
+  setOperationAction(ISD::INSERT_VECTOR_ELT , MVT::v8f32, Custom);
+  setOperationAction(ISD::EXTRACT_SUBVECTOR , MVT::v2i32, Custom);
+  setOperationAction(ISD::EXTRACT_SUBVECTOR , MVT::v2f32, Custom);
+  setOperationAction(ISD::EXTRACT_SUBVECTOR , MVT::v4i32, Custom);
+  setOperationAction(ISD::EXTRACT_SUBVECTOR , MVT::v4f32, Custom);
+  setOperationAction(ISD::CONCAT_VECTORS    , MVT::v4i32, Custom);
+  setOperationAction(ISD::CONCAT_VECTORS    , MVT::v4f32, Custom);
+  setOperationAction(ISD::CONCAT_VECTORS    , MVT::v8i32, Custom);
+  setOperationAction(ISD::CONCAT_VECTORS    , MVT::v8f32, Custom);
 
   setOperationAction(ISD::EXTRACT_VECTOR_ELT, MVT::v2i32, Custom);
   setOperationAction(ISD::EXTRACT_VECTOR_ELT, MVT::v4i32, Custom);
+  setOperationAction(ISD::EXTRACT_VECTOR_ELT, MVT::v8i32, Custom);
   setOperationAction(ISD::EXTRACT_VECTOR_ELT, MVT::v2f32, Custom);
   setOperationAction(ISD::EXTRACT_VECTOR_ELT, MVT::v4f32, Custom);
+  setOperationAction(ISD::EXTRACT_VECTOR_ELT, MVT::v8f32, Custom);
+
+  // Vector compares have no flags to go through, they produce lane masks
+  // and selects blend with them.
+  setOperationAction(ISD::SETCC             , MVT::v2i32, Custom);
+  setOperationAction(ISD::SETCC             , MVT::v4i32, Custom);
+  setOperationAction(ISD::SETCC             , MVT::v8i32, Custom);
+  setOperationAction(ISD::SETCC             , MVT::v2f32, Custom);
+  setOperationAction(ISD::SETCC             , MVT::v4f32, Custom);
+  setOperationAction(ISD::SETCC             , MVT::v8f32, Custom);
+  setOperationAction(ISD::VSELECT           , MVT::v2i32, Custom);
+  setOperationAction(ISD::VSELECT           , MVT::v4i32, Custom);
+  setOperationAction(ISD::VSELECT           , MVT::v8i32, Custom);
+  setOperationAction(ISD::VSELECT           , MVT::v2f32, Custom);
+  setOperationAction(ISD::VSELECT           , MVT::v4f32, Custom);
+  setOperationAction(ISD::VSELECT           , MVT::v8f32, Custom);
+
+  // Only the signed conversions have [N] forms.
+  setOperationAction(ISD::FP_TO_UINT        , MVT::v2i32, Expand);
+  setOperationAction(ISD::FP_TO_UINT        , MVT::v4i32, Expand);
+  setOperationAction(ISD::FP_TO_UINT        , MVT::v8i32, Expand);
+  setOperationAction(ISD::UINT_TO_FP        , MVT::v2i32, Expand);
+  setOperationAction(ISD::UINT_TO_FP        , MVT::v4i32, Expand);
+  setOperationAction(ISD::UINT_TO_FP        , MVT::v8i32, Expand);
+
+  setBooleanContents(ZeroOrOneBooleanContent);
+  setBooleanVectorContents(ZeroOrNegativeOneBooleanContent);
+
+  setTargetDAGCombine(ISD::ADD);
+  setTargetDAGCombine(ISD::EXTRACT_VECTOR_ELT);
 
   setMinFunctionAlignment(2);
 
@@ -676,6 +947,12 @@ const char *MandarinTargetLowering::getTargetNodeName(unsigned Opcode) const {
 		return "MDISD::LOW";
 	case MDISD::CALL:
 		return "MDISD::CALL";
+	case MDISD::TAIL_CALL:
+		return "MDISD::TAIL_CALL";
+	case MDISD::VSPLAT:
+		return "MDISD::VSPLAT";
+	case MDISD::SDIV:
+		return "MDISD::SDIV";
 	}
 }
 
@@ -699,6 +976,13 @@ void MandarinTargetLowering::computeMaskedBitsForTargetNode
 
   switch (Op.getOpcode()) {
   default: break;
+  case MDISD::LOW:
+    // A lo16 value, or a whole small code model address.
+    KnownZero = APInt::getHighBitsSet(KnownZero.getBitWidth(), 16);
+    break;
+  case MDISD::HIGH:
+    KnownZero = APInt::getLowBitsSet(KnownZero.getBitWidth(), 16);
+    break;
   case MDISD::SELECT_CC:
     DAG.ComputeMaskedBits(Op.getOperand(1), KnownZero, KnownOne, Depth+1);
     DAG.ComputeMaskedBits(Op.getOperand(0), KnownZero2, KnownOne2, Depth+1);
@@ -712,6 +996,218 @@ void MandarinTargetLowering::computeMaskedBitsForTargetNode
   }
 }
 
+unsigned MandarinTargetLowering::ComputeNumSignBitsForTargetNode(SDValue Op,
+                                                         unsigned Depth) const {
+  switch (Op.getOpcode()) {
+  default:
+    return 1;
+  case MDISD::LOW:
+    return 16;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// DAG combines
+//===----------------------------------------------------------------------===//
+
+// Move a constant offset into the symbol of a LOW or HIGH + LOW address, so
+// that it folds into the relocation instead of costing an add. A LOW on its
+// own is the whole address only in the small code model, elsewhere it is the
+// low half and the carry into HIGH would be lost.
+static SDValue PerformAddressOffsetCombine(SDNode *N, SelectionDAG &DAG,
+                                           bool SmallCode) {
+  ConstantSDNode *C = dyn_cast<ConstantSDNode>(N->getOperand(1));
+  SDValue Addr = N->getOperand(0);
+  if (!C || !Addr.hasOneUse())
+    return SDValue();
+
+  SDValue Hi, Lo = Addr;
+  if (Addr.getOpcode() == ISD::ADD &&
+      Addr.getOperand(0).getOpcode() == MDISD::HIGH &&
+      Addr.getOperand(1).getOpcode() == MDISD::LOW) {
+    Hi = Addr.getOperand(0);
+    Lo = Addr.getOperand(1);
+  }
+
+  if (Lo.getOpcode() != MDISD::LOW || (!Hi.getNode() && !SmallCode))
+    return SDValue();
+
+  SDLoc dl(N);
+  EVT VT = N->getValueType(0);
+  int64_t Offset = C->getSExtValue();
+
+  // Rebuild a symbol operand of LOW or HIGH with the offset added.
+  SDValue NewSym[2];
+  SDValue Parts[2] = { Lo, Hi };
+  for (unsigned i = 0; i != 2; ++i) {
+    if (!Parts[i].getNode())
+      continue;
+    SDValue Sym = Parts[i].getOperand(0);
+    if (GlobalAddressSDNode *GA = dyn_cast<GlobalAddressSDNode>(Sym))
+      NewSym[i] = DAG.getTargetGlobalAddress(GA->getGlobal(), dl, VT,
+                                             GA->getOffset() + Offset,
+                                             GA->getTargetFlags());
+    else if (ConstantPoolSDNode *CP = dyn_cast<ConstantPoolSDNode>(Sym)) {
+      if (CP->isMachineConstantPoolEntry())
+        return SDValue();
+      NewSym[i] = DAG.getTargetConstantPool(CP->getConstVal(), VT,
+                                            CP->getAlignment(),
+                                            CP->getOffset() + Offset,
+                                            CP->getTargetFlags());
+    } else
+      return SDValue();
+  }
+
+  SDValue Res = DAG.getNode(MDISD::LOW, dl, VT, NewSym[0]);
+  if (Hi.getNode())
+    Res = DAG.getNode(ISD::ADD, dl, VT,
+                      DAG.getNode(MDISD::HIGH, dl, VT, NewSym[1]), Res);
+  return Res;
+}
+
+// Operations a shuffle reduction tree is built from. Min and max come in as
+// select(setcc(a, b), a, b).
+static bool isReductionOp(SDValue Op) {
+  switch (Op.getOpcode()) {
+  default:
+    return false;
+  case ISD::ADD:
+  case ISD::MUL:
+  case ISD::AND:
+  case ISD::OR:
+  case ISD::XOR:
+  case ISD::FADD:
+  case ISD::FMUL:
+    return true;
+  case ISD::VSELECT: {
+    SDValue Cond = Op.getOperand(0);
+    return Cond.getOpcode() == ISD::SETCC &&
+           Cond.getOperand(0) == Op.getOperand(1) &&
+           Cond.getOperand(1) == Op.getOperand(2);
+  }
+  }
+}
+
+static SDValue getReductionOperand(SDValue Op, unsigned i) {
+  return Op.getOperand(Op.getOpcode() == ISD::VSELECT ? i + 1 : i);
+}
+
+// Match one level of a reduction tree, op(Src, shuffle(Src, Lanes)) in either
+// order, and return Src.
+static SDValue matchReductionStep(SDValue Op, const int *Lanes,
+                                  unsigned NumLanes, bool &SrcFirst) {
+  if (!isReductionOp(Op))
+    return SDValue();
+
+  for (unsigned i = 0; i != 2; ++i) {
+    SDValue Src = getReductionOperand(Op, i);
+    SDValue Shuf = getReductionOperand(Op, 1 - i);
+    if (Shuf.getOpcode() != ISD::VECTOR_SHUFFLE || Shuf.getOperand(0) != Src)
+      continue;
+
+    ShuffleVectorSDNode *SVN = cast<ShuffleVectorSDNode>(Shuf.getNode());
+    bool Match = true;
+    for (unsigned j = 0; j != NumLanes; ++j)
+      Match &= SVN->getMaskElt(j) == Lanes[j];
+    if (Match) {
+      SrcFirst = i == 0;
+      return Src;
+    }
+  }
+
+  return SDValue();
+}
+
+// Redo the operation of reduction step Op on A and B of type VT.
+static SDValue getReductionStep(SDValue Op, SDValue A, SDValue B, EVT VT,
+                                SDLoc dl, SelectionDAG &DAG) {
+  if (Op.getOpcode() != ISD::VSELECT)
+    return DAG.getNode(Op.getOpcode(), dl, VT, A, B);
+
+  SDValue Cond = Op.getOperand(0);
+  ISD::CondCode CC = cast<CondCodeSDNode>(Cond.getOperand(2))->get();
+  if (!VT.isVector())
+    return DAG.getSelectCC(dl, A, B, A, B, CC);
+
+  EVT CondVT = EVT::getVectorVT(*DAG.getContext(),
+                                Cond.getValueType().getVectorElementType(),
+                                VT.getVectorNumElements());
+  return DAG.getNode(ISD::VSELECT, dl, VT,
+                     DAG.getSetCC(dl, CondVT, A, B, CC), A, B);
+}
+
+// Lane 0 of a shuffle reduction tree, as the loop vectorizer emits it:
+//   t = op(v, shuffle(v, <2, 3, u, u>))
+//   r = op(t, shuffle(t, <1, u, u, u>))
+// The first level becomes one pairwise op on the halves of the quad and the
+// second a scalar op on the two lanes of the result, which combines the
+// lanes in the same order. No shuffles or quad-wide ops are left.
+static SDValue PerformReductionCombine(SDNode *N, SelectionDAG &DAG) {
+  ConstantSDNode *Lane = dyn_cast<ConstantSDNode>(N->getOperand(1));
+  if (!Lane || !Lane->isNullValue())
+    return SDValue();
+
+  SDValue Root = N->getOperand(0);
+  EVT VT = Root.getValueType();
+  if (VT != MVT::v2i32 && VT != MVT::v2f32 &&
+      VT != MVT::v4i32 && VT != MVT::v4f32)
+    return SDValue();
+
+  EVT EltVT = VT.getVectorElementType();
+  if (N->getValueType(0) != EltVT)
+    return SDValue();
+
+  static const int Lanes1[] = { 1 };
+  static const int Lanes23[] = { 2, 3 };
+  SDLoc dl(N);
+
+  bool LastFirst, HalfFirst;
+  SDValue Pair = matchReductionStep(Root, Lanes1, 1, LastFirst);
+  if (!Pair.getNode())
+    return SDValue();
+
+  if (VT.getVectorNumElements() == 4) {
+    SDValue Half = Pair;
+    SDValue V = matchReductionStep(Half, Lanes23, 2, HalfFirst);
+    if (!V.getNode())
+      return SDValue();
+
+    EVT HalfVT = EVT::getVectorVT(*DAG.getContext(), EltVT, 2);
+    SDValue Lo = DAG.getNode(ISD::EXTRACT_SUBVECTOR, dl, HalfVT, V,
+                             DAG.getIntPtrConstant(0));
+    SDValue Hi = DAG.getNode(ISD::EXTRACT_SUBVECTOR, dl, HalfVT, V,
+                             DAG.getIntPtrConstant(2));
+    Pair = HalfFirst ? getReductionStep(Half, Lo, Hi, HalfVT, dl, DAG)
+                     : getReductionStep(Half, Hi, Lo, HalfVT, dl, DAG);
+  }
+
+  SDValue X = DAG.getNode(ISD::EXTRACT_VECTOR_ELT, dl, EltVT, Pair,
+                          DAG.getIntPtrConstant(0));
+  SDValue Y = DAG.getNode(ISD::EXTRACT_VECTOR_ELT, dl, EltVT, Pair,
+                          DAG.getIntPtrConstant(1));
+  return LastFirst ? getReductionStep(Root, X, Y, EltVT, dl, DAG)
+                   : getReductionStep(Root, Y, X, EltVT, dl, DAG);
+}
+
+SDValue MandarinTargetLowering::PerformDAGCombine(SDNode *N,
+                                                 DAGCombinerInfo &DCI) const {
+  CodeModel::Model CM = getTargetMachine().getCodeModel();
+
+  switch (N->getOpcode()) {
+  default: break;
+  case ISD::ADD:
+    return PerformAddressOffsetCombine(N, DCI.DAG,
+                                       CM != CodeModel::Medium &&
+                                       CM != CodeModel::Large);
+  case ISD::EXTRACT_VECTOR_ELT:
+    if (DCI.isBeforeLegalizeOps())
+      return PerformReductionCombine(N, DCI.DAG);
+    break;
+  }
+
+  return SDValue();
+}
+
 // Convert to a target node and set target flags.
 SDValue MandarinTargetLowering::withTargetFlags(SDValue Op, unsigned TF,
                                              SelectionDAG &DAG) const
@@ -728,6 +1224,11 @@ SDValue MandarinTargetLowering::withTargetFlags(SDValue Op, unsigned TF,
                                      CP->getAlignment(),
                                      CP->getOffset(), TF);
 
+  if (const JumpTableSDNode *JT = dyn_cast<JumpTableSDNode>(Op))
+    return DAG.getTargetJumpTable(JT->getIndex(),
+                                  JT->getValueType(0),
+                                  TF);
+
   if (const BlockAddressSDNode *BA = dyn_cast<BlockAddressSDNode>(Op))
     return DAG.getTargetBlockAddress(BA->getBlockAddress(),
                                      Op.getValueType(),
@@ -743,68 +1244,61 @@ SDValue MandarinTargetLowering::withTargetFlags(SDValue Op, unsigned TF,
 
 
 // Build SDNodes for producing an address from a GlobalAddress, ConstantPool,
-// or ExternalSymbol SDNode.
+// JumpTable, BlockAddress or ExternalSymbol SDNode.
+//
+// Small code model: all data lives in the first 64kb, a single lo16 value is
+// the whole address and it folds straight into absolute loads and stores.
+// Medium and Large code models: the address space is 32 bit, so the address
+// is formed as (hi16 << 16) + lo16 in both cases.
 SDValue MandarinTargetLowering::LowerAddress(SDValue Op, SelectionDAG &DAG) const
 {
 	SDLoc DL(Op);
 	EVT VT = getPointerTy();
 
-    if (getTargetMachine().getRelocationModel() != Reloc::PIC_)
-	{
-		// %hi/%lo relocation
-		// This is a generic model, but we will use a simplified one
-		/*SDValue HiPart = DAG.getNode(MDISD::HIGH, DL, VT, withTargetFlags(Op, MDII::MO_HI16, DAG));
-		SDValue LoPart = DAG.getNode(MDISD::LOW, DL, VT, withTargetFlags(Op, MDII::MO_LO16, DAG));
-		return DAG.getNode(ISD::ADD, DL, VT, HiPart, LoPart);*/
+	if (getTargetMachine().getRelocationModel() == Reloc::PIC_)
+		report_fatal_error("Position independent code is not supported by the Mandarin target");
 
+	switch (getTargetMachine().getCodeModel())
+	{
+	default:
+		llvm_unreachable("Unsupported absolute code model");
+	case CodeModel::Default:
+	case CodeModel::JITDefault:
+	case CodeModel::Small:
 		// 64kb
 		return DAG.getNode(MDISD::LOW, DL, VT, withTargetFlags(Op, MDII::MO_LO16, DAG));
+	case CodeModel::Medium:
+	case CodeModel::Large:
+	{
+		// %hi/%lo relocation
+		SDValue HiPart = DAG.getNode(MDISD::HIGH, DL, VT, withTargetFlags(Op, MDII::MO_HI16, DAG));
+		SDValue LoPart = DAG.getNode(MDISD::LOW, DL, VT, withTargetFlags(Op, MDII::MO_LO16, DAG));
+		return DAG.getNode(ISD::ADD, DL, VT, HiPart, LoPart);
+	}
 	}
-  
-	llvm_unreachable("Unsupported absolute code model");
 }
 
 static SDValue EmitCMP(SDValue &LHS, SDValue &RHS, SDValue &TargetCC,
                        ISD::CondCode CC,
                        SDLoc dl, SelectionDAG &DAG) {
 
-  MDCC::CondCodes TCC = MDCC::COND_INVALID;
-
-  // TODO: I have no idea how unsigned operations are performed
+  // Minor optimization: if LHS is a constant, swap operands, then the constant can be folded into comparison.
+  if (LHS.getOpcode() == ISD::Constant) {
+    std::swap(LHS, RHS);
+    CC = ISD::getSetCCSwappedOperands(CC);
+  }
 
-  switch (CC) {
-  default:
-	  llvm_unreachable("Invalid condition!");
-  case ISD::SETEQ:
-    TCC = MDCC::COND_EQ;
-    // Minor optimization: if LHS is a constant, swap operands, then the constant can be folded into comparison.
-    if (LHS.getOpcode() == ISD::Constant)
-      std::swap(LHS, RHS);
-    break;
-  case ISD::SETGT:
-    TCC = MDCC::COND_GR;
-    break;
-  case ISD::SETGE:
-    TCC = MDCC::COND_GE;
-    break;
-  case ISD::SETLT:
-    TCC = MDCC::COND_LS;
-    break;
-  case ISD::SETLE:
-    TCC = MDCC::COND_LE;
-    break;
-  case ISD::SETNE:
-    TCC = MDCC::COND_NE;
-    // Minor optimization: if LHS is a constant, swap operands, then the constant can be folded into comparison.
-    if (LHS.getOpcode() == ISD::Constant)
-      std::swap(LHS, RHS);
-    break;
+  if (LHS.getValueType().isFloatingPoint()) {
+    TargetCC = DAG.getConstant(DAGFloatCCToMDCC(CC), MVT::i32);
+    return DAG.getNode(MDISD::FCMP, dl, MVT::Glue, LHS, RHS);
   }
 
+  MDCC::CondCodes TCC = DAGIntCCToMDCC(CC);
   TargetCC = DAG.getConstant(TCC, MVT::i32);
 
-  if(LHS.getValueType().isFloatingPoint())
-	  return DAG.getNode(MDISD::FCMP, dl, MVT::Glue, LHS, RHS);
+  // cmp compares unsigned, scmp signed. Equality works with either.
+  if (MDCC::isUnsigned(TCC))
+    return DAG.getNode(MDISD::CMP, dl, MVT::Glue, LHS, RHS);
 
   return DAG.getNode(MDISD::ICMP, dl, MVT::Glue, LHS, RHS);
 }
@@ -818,6 +1312,14 @@ SDValue MandarinTargetLowering::LowerBR_CC(SDValue Op, SelectionDAG &DAG) const
 	SDValue Dest  = Op.getOperand(4);
 	SDLoc dl  (Op);
 
+	// 64-bit compares are reduced to a condition bit tested against zero.
+	if (LHS.getValueType() == MVT::i64 || LHS.getValueType() == MVT::f64)
+	{
+		LHS = getConditionBit(LHS, RHS, CC, dl, DAG);
+		RHS = DAG.getConstant(0, MVT::i32);
+		CC = ISD::SETNE;
+	}
+
 	SDValue TargetCC;
     SDValue Flag = EmitCMP(LHS, RHS, TargetCC, CC, dl, DAG);
 
@@ -825,6 +1327,329 @@ SDValue MandarinTargetLowering::LowerBR_CC(SDValue Op, SelectionDAG &DAG) const
                      Chain, Dest, TargetCC, Flag);
 }
 
+//===----------------------------------------------------------------------===//
+// 64-bit integers
+//
+// i64 values live in a DoubleRegs pair with the low word in r2sub0 and are
+// operated on as two i32 halves. Halves of constants and of pairs built here
+// are taken directly so that chains of i64 operations stay in 32-bit nodes.
+//===----------------------------------------------------------------------===//
+
+static SDValue getHalf32(SDValue V, bool Hi, SDLoc dl, SelectionDAG &DAG) {
+	if (ConstantSDNode *C = dyn_cast<ConstantSDNode>(V))
+	{
+		uint64_t Val = C->getZExtValue();
+		return DAG.getConstant(Hi ? Val >> 32 : Val & 0xFFFFFFFF, MVT::i32);
+	}
+
+	if (V.getOpcode() == ISD::UNDEF)
+		return DAG.getUNDEF(MVT::i32);
+
+	if (V.isMachineOpcode() && V.getMachineOpcode() == TargetOpcode::REG_SEQUENCE)
+		return V.getOperand(Hi ? 3 : 1);
+
+	return DAG.getTargetExtractSubreg(Hi ? MD::r2sub1 : MD::r2sub0, dl,
+	                                  MVT::i32, V);
+}
+
+static SDValue getLo32(SDValue V, SDLoc dl, SelectionDAG &DAG) {
+	return getHalf32(V, false, dl, DAG);
+}
+
+static SDValue getHi32(SDValue V, SDLoc dl, SelectionDAG &DAG) {
+	return getHalf32(V, true, dl, DAG);
+}
+
+static SDValue getPair64(SDValue Lo, SDValue Hi, SDLoc dl, SelectionDAG &DAG) {
+	const SDValue Ops[] = {
+		DAG.getTargetConstant(MD::DoubleRegsRegClassID, MVT::i32),
+		Lo, DAG.getTargetConstant(MD::r2sub0, MVT::i32),
+		Hi, DAG.getTargetConstant(MD::r2sub1, MVT::i32)
+	};
+	return SDValue(DAG.getMachineNode(TargetOpcode::REG_SEQUENCE, dl,
+	                                  MVT::i64, Ops), 0);
+}
+
+//===----------------------------------------------------------------------===//
+// Branchless conditions
+//
+// There is no setcc instruction, compare results only reach the branch unit.
+// Conditions are instead computed arithmetically into bit 0 of a register
+// (Hacker's Delight, 2-12) and selects become mask blends.
+//===----------------------------------------------------------------------===//
+
+// The helpers below work lane-wise on i32 as well as on the vector types, so
+// vector compares use the same formulas as scalar ones.
+static SDValue getSignToBit0(SDValue V, SDLoc dl, SelectionDAG &DAG) {
+	EVT VT = V.getValueType();
+	return DAG.getNode(ISD::SRL, dl, VT, V, DAG.getConstant(31, VT));
+}
+
+static SDValue getNeg(SDValue V, SDLoc dl, SelectionDAG &DAG) {
+	EVT VT = V.getValueType();
+	return DAG.getNode(ISD::SUB, dl, VT, DAG.getConstant(0, VT), V);
+}
+
+// Map float bits to an integer that orders like the float value, with both
+// zeros mapping to 0: negative values become the negated magnitude.
+static SDValue getOrderedFloatBits(SDValue V, SDLoc dl, SelectionDAG &DAG) {
+	EVT VT = V.getValueType();
+	EVT IntVT = VT.isVector() ? VT.changeVectorElementTypeToInteger() : EVT(MVT::i32);
+	SDValue Bits = DAG.getNode(ISD::BITCAST, dl, IntVT, V);
+	SDValue One = DAG.getConstant(1, IntVT);
+
+	SDValue Magnitude = DAG.getNode(ISD::SRL, dl, IntVT,
+		DAG.getNode(ISD::SHL, dl, IntVT, Bits, One), One);
+	SDValue Sign = getNeg(getSignToBit0(Bits, dl, DAG), dl, DAG);
+
+	return DAG.getNode(ISD::SUB, dl, IntVT,
+		DAG.getNode(ISD::XOR, dl, IntVT, Magnitude, Sign), Sign);
+}
+
+// Integer condition to use on the ordered float bits, or SETCC_INVALID when
+// the NaN behaviour of CC can't be ignored.
+static ISD::CondCode getIntCondForFloat(ISD::CondCode CC, bool NoNaNs) {
+	switch (CC) {
+	default: return ISD::SETCC_INVALID;
+	case ISD::SETEQ: return ISD::SETEQ;
+	case ISD::SETNE: return ISD::SETNE;
+	case ISD::SETLT: return ISD::SETLT;
+	case ISD::SETLE: return ISD::SETLE;
+	case ISD::SETGT: return ISD::SETGT;
+	case ISD::SETGE: return ISD::SETGE;
+	case ISD::SETOEQ: case ISD::SETUEQ: return NoNaNs ? ISD::SETEQ : ISD::SETCC_INVALID;
+	case ISD::SETONE: case ISD::SETUNE: return NoNaNs ? ISD::SETNE : ISD::SETCC_INVALID;
+	case ISD::SETOLT: case ISD::SETULT: return NoNaNs ? ISD::SETLT : ISD::SETCC_INVALID;
+	case ISD::SETOLE: case ISD::SETULE: return NoNaNs ? ISD::SETLE : ISD::SETCC_INVALID;
+	case ISD::SETOGT: case ISD::SETUGT: return NoNaNs ? ISD::SETGT : ISD::SETCC_INVALID;
+	case ISD::SETOGE: case ISD::SETUGE: return NoNaNs ? ISD::SETGE : ISD::SETCC_INVALID;
+	}
+}
+
+/// getConditionBit - Compute (LHS CC RHS) as 0 or 1 without touching the
+/// flags. Returns an empty value if it can't be done without a compare.
+SDValue MandarinTargetLowering::getConditionBit(SDValue LHS, SDValue RHS,
+                                                ISD::CondCode CC, SDLoc dl,
+                                                SelectionDAG &DAG) const
+{
+	if (LHS.getValueType() == MVT::f64)
+		return getConditionBitF64(LHS, RHS, CC, dl, DAG);
+
+	if (LHS.getValueType().getScalarType() == MVT::f32)
+	{
+		CC = getIntCondForFloat(CC, getTargetMachine().Options.NoNaNsFPMath);
+		if (CC == ISD::SETCC_INVALID)
+			return SDValue();
+
+		LHS = getOrderedFloatBits(LHS, dl, DAG);
+		RHS = getOrderedFloatBits(RHS, dl, DAG);
+	}
+
+	if (LHS.getValueType() == MVT::i64)
+		return getConditionBit64(LHS, RHS, CC, dl, DAG);
+
+	EVT VT = LHS.getValueType();
+	if (VT.getScalarType() != MVT::i32)
+		return SDValue();
+
+	// Only the "less" forms are implemented.
+	if (CC == ISD::SETGT || CC == ISD::SETGE || CC == ISD::SETUGT || CC == ISD::SETUGE)
+	{
+		std::swap(LHS, RHS);
+		CC = ISD::getSetCCSwappedOperands(CC);
+	}
+
+	ConstantSDNode *C = dyn_cast<ConstantSDNode>(RHS);
+	SDValue X = LHS, Y = RHS;
+
+	// x <= C is x < C + 1, the same form the DAG combiner canonicalizes to.
+	if (C && CC == ISD::SETLE && C->getSExtValue() < 0x7FFFFFFF)
+	{
+		CC = ISD::SETLT;
+		Y = DAG.getConstant(C->getSExtValue() + 1, VT);
+		C = cast<ConstantSDNode>(Y);
+	}
+	else if (C && CC == ISD::SETULE && !C->isAllOnesValue())
+	{
+		CC = ISD::SETULT;
+		Y = DAG.getConstant(C->getZExtValue() + 1, VT);
+		C = cast<ConstantSDNode>(Y);
+	}
+
+	switch (CC) {
+	default:
+		return SDValue();
+
+	case ISD::SETEQ:
+	case ISD::SETNE:
+	{
+		// A boolean compared to zero is its own answer.
+		if (C && C->isNullValue() &&
+		    DAG.MaskedValueIsZero(X, APInt::getHighBitsSet(32, 31)))
+		{
+			if (CC == ISD::SETNE)
+				return X;
+			return DAG.getNode(ISD::XOR, dl, VT, X, DAG.getConstant(1, VT));
+		}
+
+		SDValue Diff = (C && C->isNullValue()) ? X : DAG.getNode(ISD::XOR, dl, VT, X, Y);
+		// Sign bit of (d | -d) is set iff d != 0.
+		SDValue NonZero = DAG.getNode(ISD::OR, dl, VT, Diff, getNeg(Diff, dl, DAG));
+		if (CC == ISD::SETEQ)
+			NonZero = DAG.getNOT(dl, NonZero, VT);
+		return getSignToBit0(NonZero, dl, DAG);
+	}
+
+	case ISD::SETLT:
+	{
+		// Compares against zero, in the forms the DAG combiner leaves them:
+		//   x < 0:  sign of x
+		//   x < 1:  x <= 0, sign of (x | (x - 1))
+		//   0 < y:  sign of (-y & ~y)
+		//   -1 < y: y >= 0, sign of ~y
+		if (C && C->isNullValue())
+			return getSignToBit0(X, dl, DAG);
+
+		if (C && C->isOne())
+			return getSignToBit0(DAG.getNode(ISD::OR, dl, VT, X,
+				DAG.getNode(ISD::SUB, dl, VT, X, DAG.getConstant(1, VT))),
+				dl, DAG);
+
+		ConstantSDNode *CX = dyn_cast<ConstantSDNode>(X);
+		if (CX && CX->isNullValue())
+			return getSignToBit0(DAG.getNode(ISD::AND, dl, VT,
+				getNeg(Y, dl, DAG), DAG.getNOT(dl, Y, VT)), dl, DAG);
+
+		if (CX && CX->isAllOnesValue())
+			return getSignToBit0(DAG.getNOT(dl, Y, VT), dl, DAG);
+
+		// (d ^ ((x ^ y) & (d ^ x))) with d = x - y, corrects d for overflow.
+		SDValue Diff = DAG.getNode(ISD::SUB, dl, VT, X, Y);
+		SDValue Overflow = DAG.getNode(ISD::AND, dl, VT,
+			DAG.getNode(ISD::XOR, dl, VT, X, Y),
+			DAG.getNode(ISD::XOR, dl, VT, Diff, X));
+		return getSignToBit0(DAG.getNode(ISD::XOR, dl, VT, Diff, Overflow), dl, DAG);
+	}
+
+	case ISD::SETLE:
+	{
+		// (x | ~y) & ((x ^ y) | ~(y - x))
+		SDValue L = DAG.getNode(ISD::OR, dl, VT, X, DAG.getNOT(dl, Y, VT));
+		SDValue R = DAG.getNode(ISD::OR, dl, VT,
+			DAG.getNode(ISD::XOR, dl, VT, X, Y),
+			DAG.getNOT(dl, DAG.getNode(ISD::SUB, dl, VT, Y, X), VT));
+		return getSignToBit0(DAG.getNode(ISD::AND, dl, VT, L, R), dl, DAG);
+	}
+
+	case ISD::SETULT:
+	{
+		// x <u 1 is x == 0, 0 <u y is y != 0.
+		ConstantSDNode *CX = dyn_cast<ConstantSDNode>(X);
+		if (C && C->isOne())
+			return getConditionBit(X, DAG.getConstant(0, VT), ISD::SETEQ, dl, DAG);
+		if (CX && CX->isNullValue())
+			return getConditionBit(Y, X, ISD::SETNE, dl, DAG);
+
+		// (~x & y) | ((~x | y) & (x - y))
+		SDValue NotX = DAG.getNOT(dl, X, VT);
+		SDValue L = DAG.getNode(ISD::AND, dl, VT, NotX, Y);
+		SDValue R = DAG.getNode(ISD::AND, dl, VT,
+			DAG.getNode(ISD::OR, dl, VT, NotX, Y),
+			DAG.getNode(ISD::SUB, dl, VT, X, Y));
+		return getSignToBit0(DAG.getNode(ISD::OR, dl, VT, L, R), dl, DAG);
+	}
+
+	case ISD::SETULE:
+	{
+		// (~x | y) & ((x ^ y) | ~(y - x))
+		SDValue L = DAG.getNode(ISD::OR, dl, VT, DAG.getNOT(dl, X, VT), Y);
+		SDValue R = DAG.getNode(ISD::OR, dl, VT,
+			DAG.getNode(ISD::XOR, dl, VT, X, Y),
+			DAG.getNOT(dl, DAG.getNode(ISD::SUB, dl, VT, Y, X), VT));
+		return getSignToBit0(DAG.getNode(ISD::AND, dl, VT, L, R), dl, DAG);
+	}
+	}
+}
+
+/// getSelectByBit - Blend TrueVal and FalseVal with a 0/1 condition bit:
+/// f ^ ((t ^ f) & -bit).
+static SDValue getSelectByBit(SDValue Bit, SDValue TrueVal, SDValue FalseVal,
+                              SDLoc dl, SelectionDAG &DAG) {
+	EVT VT = TrueVal.getValueType();
+
+	if (VT == MVT::f64)
+		return DAG.getNode(ISD::BITCAST, dl, VT,
+			getSelectByBit(Bit, DAG.getNode(ISD::BITCAST, dl, MVT::i64, TrueVal),
+			               DAG.getNode(ISD::BITCAST, dl, MVT::i64, FalseVal), dl, DAG));
+
+	if (VT == MVT::i64)
+		return getPair64(
+			getSelectByBit(Bit, getLo32(TrueVal, dl, DAG), getLo32(FalseVal, dl, DAG), dl, DAG),
+			getSelectByBit(Bit, getHi32(TrueVal, dl, DAG), getHi32(FalseVal, dl, DAG), dl, DAG),
+			dl, DAG);
+
+	ConstantSDNode *T = dyn_cast<ConstantSDNode>(TrueVal);
+	ConstantSDNode *F = dyn_cast<ConstantSDNode>(FalseVal);
+	if (T && F && T->isOne() && F->isNullValue())
+		return Bit;
+	if (T && F && T->isNullValue() && F->isOne())
+		return DAG.getNode(ISD::XOR, dl, MVT::i32, Bit, DAG.getConstant(1, MVT::i32));
+
+	SDValue T32 = DAG.getNode(ISD::BITCAST, dl, MVT::i32, TrueVal);
+	SDValue F32 = DAG.getNode(ISD::BITCAST, dl, MVT::i32, FalseVal);
+	SDValue Mask = getNeg(Bit, dl, DAG);
+
+	SDValue Res;
+	if (F && F->isNullValue())
+		Res = DAG.getNode(ISD::AND, dl, MVT::i32, T32, Mask);
+	else
+		Res = DAG.getNode(ISD::XOR, dl, MVT::i32, F32,
+			DAG.getNode(ISD::AND, dl, MVT::i32,
+				DAG.getNode(ISD::XOR, dl, MVT::i32, T32, F32), Mask));
+
+	return DAG.getNode(ISD::BITCAST, dl, VT, Res);
+}
+
+// An operand that is worth computing only on the path that uses it. The
+// diamond lets MachineSink move it there.
+static bool isExpensiveSelectOperand(SDValue V) {
+	if (!V.hasOneUse())
+		return false;
+
+	switch (V.getOpcode()) {
+	default:
+		return false;
+	case ISD::LOAD:
+	case ISD::SDIV:
+	case ISD::UDIV:
+	case ISD::SREM:
+	case ISD::UREM:
+	case MDISD::SDIV:
+	case ISD::FDIV:
+	case ISD::FREM:
+		return true;
+	}
+}
+
+SDValue MandarinTargetLowering::LowerSETCC(SDValue Op, SelectionDAG &DAG) const
+{
+	SDValue LHS = Op.getOperand(0);
+	SDValue RHS = Op.getOperand(1);
+	ISD::CondCode CC = cast<CondCodeSDNode>(Op.getOperand(2))->get();
+	SDLoc dl(Op);
+
+	if (Op.getValueType().isVector())
+		return LowerVectorSETCC(Op, DAG);
+
+	SDValue Bit = getConditionBit(LHS, RHS, CC, dl, DAG);
+	if (Bit.getNode())
+		return Bit;
+
+	// Ordered float compares need the compare instruction.
+	return EmitSelectCC(LHS, RHS, DAG.getConstant(1, MVT::i32),
+	                    DAG.getConstant(0, MVT::i32), CC, dl, DAG);
+}
+
 SDValue MandarinTargetLowering::LowerSELECT_CC(SDValue Op, SelectionDAG &DAG) const
 {
 	SDValue LHS = Op.getOperand(0);
@@ -834,36 +1659,834 @@ SDValue MandarinTargetLowering::LowerSELECT_CC(SDValue Op, SelectionDAG &DAG) co
 	SDValue FalseVal = Op.getOperand(3);
 	SDLoc dl(Op);
 
-	MDCC::CondCodes MDCC = MDCC::COND_INVALID;
+	bool Wide = LHS.getValueType().getSizeInBits() == 64 ||
+	            TrueVal.getValueType().getSizeInBits() == 64;
+	bool KeepBranch = isExpensiveSelectOperand(TrueVal) ||
+	                  isExpensiveSelectOperand(FalseVal);
 
-	SDValue CompareFlag;
-	if (LHS.getValueType().isInteger())
+	// The diamond has no 64-bit operands.
+	if (!KeepBranch || Wide)
 	{
-		CompareFlag = DAG.getNode(MDISD::ICMP, dl, MVT::Glue, LHS, RHS);
-		MDCC = DAGIntCCToMDCC(CC);
-	} else {
-		CompareFlag = DAG.getNode(MDISD::FCMP, dl, MVT::Glue, LHS, RHS);
-		MDCC = DAGFloatCCToMDCC(CC);
+		SDValue Bit = getConditionBit(LHS, RHS, CC, dl, DAG);
+		if (Bit.getNode())
+			return getSelectByBit(Bit, TrueVal, FalseVal, dl, DAG);
 	}
+
+	// Ordered float compare selecting 64-bit values: blend by the compare result.
+	if (Wide)
+		return getSelectByBit(EmitSelectCC(LHS, RHS, DAG.getConstant(1, MVT::i32),
+		                                   DAG.getConstant(0, MVT::i32), CC, dl, DAG),
+		                      TrueVal, FalseVal, dl, DAG);
+
+	return EmitSelectCC(LHS, RHS, TrueVal, FalseVal, CC, dl, DAG);
+}
+
+/// EmitSelectCC - Build the compare + SELECT_CC pseudo, which the custom
+/// inserter expands into a branch diamond.
+SDValue MandarinTargetLowering::EmitSelectCC(SDValue LHS, SDValue RHS,
+                                             SDValue TrueVal, SDValue FalseVal,
+                                             ISD::CondCode CC, SDLoc dl,
+                                             SelectionDAG &DAG) const
+{
+	SDValue TargetCC;
+	SDValue CompareFlag = EmitCMP(LHS, RHS, TargetCC, CC, dl, DAG);
 	return DAG.getNode(MDISD::SELECT_CC, dl, TrueVal.getValueType(), TrueVal, FalseVal,
-						DAG.getConstant(MDCC, MVT::i32), CompareFlag);
+						TargetCC, CompareFlag);
 }
 
-SDValue MandarinTargetLowering::LowerEXTRACT_VECTOR_ELT(SDValue Op, SelectionDAG &DAG) const
+// There is no arithmetic shift:
+//   sra(x, C) = ((x >>u C) ^ k) - k, k = 0x80000000 >>u C
+//   sra(x, n) = ((x ^ s) >>u n) ^ s, s = -(x >>u 31)
+SDValue MandarinTargetLowering::LowerSRA(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+	SDValue X = Op.getOperand(0);
+	SDValue Amt = Op.getOperand(1);
+
+	if (ConstantSDNode *C = dyn_cast<ConstantSDNode>(Amt))
+	{
+		unsigned ShAmt = C->getZExtValue() & 31;
+		if (ShAmt == 0)
+			return X;
+
+		SDValue Shifted = DAG.getNode(ISD::SRL, dl, MVT::i32, X,
+		                              DAG.getConstant(ShAmt, MVT::i32));
+		if (ShAmt == 31)
+			return getNeg(Shifted, dl, DAG);
+
+		SDValue K = DAG.getConstant(0x80000000U >> ShAmt, MVT::i32);
+		return DAG.getNode(ISD::SUB, dl, MVT::i32,
+			DAG.getNode(ISD::XOR, dl, MVT::i32, Shifted, K), K);
+	}
+
+	SDValue Sign = getNeg(getSignToBit0(X, dl, DAG), dl, DAG);
+	SDValue Res = DAG.getNode(ISD::XOR, dl, MVT::i32, X, Sign);
+	Res = DAG.getNode(ISD::SRL, dl, MVT::i32, Res, Amt);
+	return DAG.getNode(ISD::XOR, dl, MVT::i32, Res, Sign);
+}
+
+// Unsigned division from the signed one (Hacker's Delight, 9-3): the halved
+// dividend is a positive signed value, its quotient doubled is off by at most
+// one. Divisors of 2^31 and above have a quotient of 0 or 1, there the
+// dividend is masked to 0 and the correction alone gives the result. The
+// divide is MDISD::SDIV: both its operands are often known positive, and the
+// combiner would fold an ISD::SDIV straight back into the udiv being lowered.
+SDValue MandarinTargetLowering::LowerUDIVREM(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+	SDValue N = Op.getOperand(0);
+	SDValue D = Op.getOperand(1);
+	SDValue One = DAG.getConstant(1, MVT::i32);
+
+	// n & ~(d >>s 31)
+	SDValue SmallD = DAG.getNode(ISD::SUB, dl, MVT::i32, getSignToBit0(D, dl, DAG), One);
+	SDValue N1 = DAG.getNode(ISD::AND, dl, MVT::i32, N, SmallD);
+
+	SDValue Q = DAG.getNode(MDISD::SDIV, dl, MVT::i32,
+		DAG.getNode(ISD::SRL, dl, MVT::i32, N1, One), D);
+	Q = DAG.getNode(ISD::SHL, dl, MVT::i32, Q, One);
+	SDValue R = DAG.getNode(ISD::SUB, dl, MVT::i32, N,
+		DAG.getNode(ISD::MUL, dl, MVT::i32, Q, D));
+
+	// r >= d: one more d fits.
+	SDValue Fix = getConditionBit(R, D, ISD::SETUGE, dl, DAG);
+	Q = DAG.getNode(ISD::ADD, dl, MVT::i32, Q, Fix);
+	R = DAG.getNode(ISD::SUB, dl, MVT::i32, R,
+		DAG.getNode(ISD::AND, dl, MVT::i32, D, getNeg(Fix, dl, DAG)));
+
+	switch (Op.getOpcode()) {
+	default:
+		llvm_unreachable("Unexpected division!");
+	case ISD::UDIV:
+		return Q;
+	case ISD::UREM:
+		return R;
+	case ISD::UDIVREM:
+	{
+		const SDValue Ops[] = { Q, R };
+		return DAG.getMergeValues(Ops, 2, dl);
+	}
+	}
+}
+
+// sext_inreg(x, iN) = ((x & (2^N - 1)) ^ 2^(N-1)) - 2^(N-1)
+SDValue MandarinTargetLowering::LowerSIGN_EXTEND_INREG(SDValue Op,
+                                                       SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+	SDValue X = Op.getOperand(0);
+	EVT InnerVT = cast<VTSDNode>(Op.getOperand(1))->getVT();
+	unsigned Bits = InnerVT.getSizeInBits();
+
+	// The high word is the sign of the extended low word.
+	if (Op.getValueType() == MVT::i64)
+	{
+		SDValue Lo = getLo32(X, dl, DAG);
+		if (Bits < 32)
+			Lo = DAG.getNode(ISD::SIGN_EXTEND_INREG, dl, MVT::i32, Lo,
+			                 DAG.getValueType(InnerVT));
+		return getPair64(Lo, DAG.getNode(ISD::SRA, dl, MVT::i32, Lo,
+		                                 DAG.getConstant(31, MVT::i32)), dl, DAG);
+	}
+
+	APInt LowMask = APInt::getLowBitsSet(32, Bits);
+	if (!DAG.MaskedValueIsZero(X, ~LowMask))
+		X = DAG.getNode(ISD::AND, dl, MVT::i32, X,
+		                DAG.getConstant(LowMask.getZExtValue(), MVT::i32));
+
+	// 0/1 -> 0/-1
+	if (Bits == 1)
+		return getNeg(X, dl, DAG);
+
+	SDValue K = DAG.getConstant(1U << (Bits - 1), MVT::i32);
+	return DAG.getNode(ISD::SUB, dl, MVT::i32,
+		DAG.getNode(ISD::XOR, dl, MVT::i32, X, K), K);
+}
+
+// The word of a float that holds the sign: the value itself for f32, the
+// high word for f64.
+static SDValue getSignWord(SDValue V, SDLoc dl, SelectionDAG &DAG) {
+	if (V.getValueType() == MVT::f64)
+		return getHi32(DAG.getNode(ISD::BITCAST, dl, MVT::i64, V), dl, DAG);
+	return DAG.getNode(ISD::BITCAST, dl, MVT::i32, V);
+}
+
+// V with its sign word replaced by Word.
+static SDValue setSignWord(SDValue V, SDValue Word, SDLoc dl, SelectionDAG &DAG) {
+	if (V.getValueType() == MVT::f64)
+	{
+		SDValue Lo = getLo32(DAG.getNode(ISD::BITCAST, dl, MVT::i64, V), dl, DAG);
+		return DAG.getNode(ISD::BITCAST, dl, MVT::f64, getPair64(Lo, Word, dl, DAG));
+	}
+	return DAG.getNode(ISD::BITCAST, dl, MVT::f32, Word);
+}
+
+// fabs(x) = (x << 1) >> 1
+SDValue MandarinTargetLowering::LowerFABS(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+	SDValue One = DAG.getConstant(1, MVT::i32);
+
+	SDValue Bits = getSignWord(Op.getOperand(0), dl, DAG);
+	Bits = DAG.getNode(ISD::SHL, dl, MVT::i32, Bits, One);
+	Bits = DAG.getNode(ISD::SRL, dl, MVT::i32, Bits, One);
+	return setSignWord(Op.getOperand(0), Bits, dl, DAG);
+}
+
+// fneg(x) = x ^ 0x80000000
+SDValue MandarinTargetLowering::LowerFNEG(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+
+	SDValue Bits = getSignWord(Op.getOperand(0), dl, DAG);
+	Bits = DAG.getNode(ISD::XOR, dl, MVT::i32, Bits,
+	                   DAG.getConstant(0x80000000, MVT::i32));
+	return setSignWord(Op.getOperand(0), Bits, dl, DAG);
+}
+
+// copysign(x, y) = ((x << 1) >> 1) | ((y >> 31) << 31)
+SDValue MandarinTargetLowering::LowerFCOPYSIGN(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+
+	SDValue One = DAG.getConstant(1, MVT::i32);
+	SDValue Magnitude = getSignWord(Op.getOperand(0), dl, DAG);
+	Magnitude = DAG.getNode(ISD::SHL, dl, MVT::i32, Magnitude, One);
+	Magnitude = DAG.getNode(ISD::SRL, dl, MVT::i32, Magnitude, One);
+
+	SDValue ShAmt = DAG.getConstant(31, MVT::i32);
+	SDValue SignBit = getSignWord(Op.getOperand(1), dl, DAG);
+	SignBit = DAG.getNode(ISD::SRL, dl, MVT::i32, SignBit, ShAmt);
+	SignBit = DAG.getNode(ISD::SHL, dl, MVT::i32, SignBit, ShAmt);
+
+	return setSignWord(Op.getOperand(0),
+		DAG.getNode(ISD::OR, dl, MVT::i32, Magnitude, SignBit), dl, DAG);
+}
+
+/// getConditionBit64 - (LHS CC RHS) on i64 operands from compares of the
+/// halves: the high words decide unless they are equal.
+SDValue MandarinTargetLowering::getConditionBit64(SDValue LHS, SDValue RHS,
+                                                  ISD::CondCode CC, SDLoc dl,
+                                                  SelectionDAG &DAG) const
+{
+	SDValue LHSLo = getLo32(LHS, dl, DAG), LHSHi = getHi32(LHS, dl, DAG);
+	SDValue RHSLo = getLo32(RHS, dl, DAG), RHSHi = getHi32(RHS, dl, DAG);
+
+	if (CC == ISD::SETEQ || CC == ISD::SETNE)
+	{
+		SDValue Diff = DAG.getNode(ISD::OR, dl, MVT::i32,
+			DAG.getNode(ISD::XOR, dl, MVT::i32, LHSLo, RHSLo),
+			DAG.getNode(ISD::XOR, dl, MVT::i32, LHSHi, RHSHi));
+		return getConditionBit(Diff, DAG.getConstant(0, MVT::i32), CC, dl, DAG);
+	}
+
+	if (CC == ISD::SETGT || CC == ISD::SETGE || CC == ISD::SETUGT || CC == ISD::SETUGE)
+	{
+		std::swap(LHSLo, RHSLo);
+		std::swap(LHSHi, RHSHi);
+		CC = ISD::getSetCCSwappedOperands(CC);
+	}
+
+	ISD::CondCode HiCC, LoCC;
+	switch (CC) {
+	default:
+		llvm_unreachable("Unexpected 64-bit condition!");
+	case ISD::SETLT:  HiCC = ISD::SETLT;  LoCC = ISD::SETULT; break;
+	case ISD::SETLE:  HiCC = ISD::SETLT;  LoCC = ISD::SETULE; break;
+	case ISD::SETULT: HiCC = ISD::SETULT; LoCC = ISD::SETULT; break;
+	case ISD::SETULE: HiCC = ISD::SETULT; LoCC = ISD::SETULE; break;
+	}
+
+	// x < 0 is the sign of the high word.
+	ConstantSDNode *CLo = dyn_cast<ConstantSDNode>(RHSLo);
+	ConstantSDNode *CHi = dyn_cast<ConstantSDNode>(RHSHi);
+	if (CC == ISD::SETLT && CLo && CHi && CLo->isNullValue() && CHi->isNullValue())
+		return getSignToBit0(LHSHi, dl, DAG);
+
+	SDValue HiLess = getConditionBit(LHSHi, RHSHi, HiCC, dl, DAG);
+	SDValue HiEqual = getConditionBit(LHSHi, RHSHi, ISD::SETEQ, dl, DAG);
+	SDValue LoLess = getConditionBit(LHSLo, RHSLo, LoCC, dl, DAG);
+	return DAG.getNode(ISD::OR, dl, MVT::i32, HiLess,
+		DAG.getNode(ISD::AND, dl, MVT::i32, HiEqual, LoLess));
+}
+
+// Add and subtract on the halves. The carry out of the low word is the sign
+// of the majority of (a, b, ~s), the borrow is the unsigned a < b of the low
+// words (Hacker's Delight, 2-13).
+SDValue MandarinTargetLowering::LowerADDSUB64(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+	SDValue A = Op.getOperand(0);
+	SDValue B = Op.getOperand(1);
+	SDValue ALo = getLo32(A, dl, DAG), AHi = getHi32(A, dl, DAG);
+	SDValue BLo = getLo32(B, dl, DAG), BHi = getHi32(B, dl, DAG);
+
+	SDValue Lo, Carry;
+	if (Op.getOpcode() == ISD::ADD)
+	{
+		Lo = DAG.getNode(ISD::ADD, dl, MVT::i32, ALo, BLo);
+		SDValue Both = DAG.getNode(ISD::AND, dl, MVT::i32, ALo, BLo);
+		SDValue Either = DAG.getNode(ISD::OR, dl, MVT::i32, ALo, BLo);
+		Carry = getSignToBit0(DAG.getNode(ISD::OR, dl, MVT::i32, Both,
+			DAG.getNode(ISD::AND, dl, MVT::i32, Either,
+			            DAG.getNOT(dl, Lo, MVT::i32))), dl, DAG);
+	} else {
+		Lo = DAG.getNode(ISD::SUB, dl, MVT::i32, ALo, BLo);
+		Carry = getConditionBit(ALo, BLo, ISD::SETULT, dl, DAG);
+	}
+
+	unsigned Opc = Op.getOpcode();
+	SDValue Hi = DAG.getNode(Opc, dl, MVT::i32,
+		DAG.getNode(Opc, dl, MVT::i32, AHi, BHi), Carry);
+	return getPair64(Lo, Hi, dl, DAG);
+}
+
+// 64-bit shifts on the halves. A variable amount n is split into m = n & 31
+// and bit 5, the bits crossing between the words are shifted in two steps
+// so that m = 0 shifts them out entirely:
+//   shl: hi = (hi << m) | ((lo >> 1) >> (31 - m)), lo = lo << m
+// and bit 5 then selects the word shifted by m - 32.
+SDValue MandarinTargetLowering::LowerShift64(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+	unsigned Opc = Op.getOpcode();
+	SDValue X = Op.getOperand(0);
+	SDValue Amt = Op.getOperand(1);
+	SDValue Lo = getLo32(X, dl, DAG), Hi = getHi32(X, dl, DAG);
+	SDValue Zero = DAG.getConstant(0, MVT::i32);
+
+	// The word the bits are shifted out of, and the word they move into.
+	SDValue From = Opc == ISD::SHL ? Lo : Hi;
+	SDValue Into = Opc == ISD::SHL ? Hi : Lo;
+	unsigned Back = Opc == ISD::SHL ? ISD::SRL : ISD::SHL;
+	unsigned Fwd = Opc == ISD::SHL ? ISD::SHL : ISD::SRL;
+
+	// What a word shifted out entirely leaves behind.
+	SDValue Fill = Opc == ISD::SRA ?
+		DAG.getNode(ISD::SRA, dl, MVT::i32, Hi, DAG.getConstant(31, MVT::i32)) :
+		Zero;
+
+	SDValue NewFrom, NewInto;
+	if (ConstantSDNode *C = dyn_cast<ConstantSDNode>(Amt))
+	{
+		unsigned ShAmt = C->getZExtValue() & 63;
+		if (ShAmt == 0)
+			return X;
+
+		if (ShAmt >= 32)
+		{
+			NewInto = DAG.getNode(Opc, dl, MVT::i32, From,
+			                      DAG.getConstant(ShAmt - 32, MVT::i32));
+			NewFrom = Fill;
+		} else {
+			NewInto = DAG.getNode(ISD::OR, dl, MVT::i32,
+				DAG.getNode(Fwd, dl, MVT::i32, Into, DAG.getConstant(ShAmt, MVT::i32)),
+				DAG.getNode(Back, dl, MVT::i32, From, DAG.getConstant(32 - ShAmt, MVT::i32)));
+			NewFrom = DAG.getNode(Opc, dl, MVT::i32, From,
+			                      DAG.getConstant(ShAmt, MVT::i32));
+		}
+	} else {
+		SDValue M = DAG.getNode(ISD::AND, dl, MVT::i32, Amt,
+		                        DAG.getConstant(31, MVT::i32));
+		SDValue Bit5 = DAG.getNode(ISD::AND, dl, MVT::i32,
+			DAG.getNode(ISD::SRL, dl, MVT::i32, Amt, DAG.getConstant(5, MVT::i32)),
+			DAG.getConstant(1, MVT::i32));
+
+		SDValue Cross = DAG.getNode(Back, dl, MVT::i32,
+			DAG.getNode(Back, dl, MVT::i32, From, DAG.getConstant(1, MVT::i32)),
+			DAG.getNode(ISD::XOR, dl, MVT::i32, M, DAG.getConstant(31, MVT::i32)));
+		SDValue Small = DAG.getNode(ISD::OR, dl, MVT::i32,
+			DAG.getNode(Fwd, dl, MVT::i32, Into, M), Cross);
+		SDValue Shifted = DAG.getNode(Opc, dl, MVT::i32, From, M);
+
+		NewInto = getSelectByBit(Bit5, Shifted, Small, dl, DAG);
+		NewFrom = getSelectByBit(Bit5, Fill, Shifted, dl, DAG);
+	}
+
+	if (Opc == ISD::SHL)
+		return getPair64(NewFrom, NewInto, dl, DAG);
+	return getPair64(NewInto, NewFrom, dl, DAG);
+}
+
+// i32 -> i64 extensions only need a high word.
+SDValue MandarinTargetLowering::LowerEXTEND64(SDValue Op, SelectionDAG &DAG) const
+{
+	SDLoc dl(Op);
+	SDValue X = Op.getOperand(0);
+	SDValue Hi;
+
+	switch (Op.getOpcode()) {
+	default:
+		llvm_unreachable("Unexpected extension!");
+	case ISD::ZERO_EXTEND:
+		Hi = DAG.getConstant(0, MVT::i32);
+		break;
+	case ISD::SIGN_EXTEND:
+		Hi = DAG.getNode(ISD::SRA, dl, MVT::i32, X, DAG.getConstant(31, MVT::i32));
+		break;
+	case ISD::ANY_EXTEND:
+		Hi = DAG.getUNDEF(MVT::i32);
+		break;
+	}
+
+	return getPair64(X, Hi, dl, DAG);
+}
+
+/// getConditionBitF64 - f64 compares call the soft-float comparison
+/// routines and test their result against zero, the unordered forms are the
+/// inverse of an ordered one or need the unordered test as well.
+SDValue MandarinTargetLowering::getConditionBitF64(SDValue LHS, SDValue RHS,
+                                                   ISD::CondCode CC, SDLoc dl,
+                                                   SelectionDAG &DAG) const
+{
+	RTLIB::Libcall LC1 = RTLIB::UNKNOWN_LIBCALL, LC2 = RTLIB::UNKNOWN_LIBCALL;
+	ISD::CondCode CC1, CC2 = ISD::SETCC_INVALID;
+
+	switch (CC) {
+	default:
+		llvm_unreachable("Unexpected f64 condition!");
+	case ISD::SETEQ:
+	case ISD::SETOEQ: LC1 = RTLIB::OEQ_F64; CC1 = ISD::SETEQ; break;
+	case ISD::SETNE:
+	case ISD::SETUNE: LC1 = RTLIB::UNE_F64; CC1 = ISD::SETNE; break;
+	case ISD::SETGE:
+	case ISD::SETOGE: LC1 = RTLIB::OGE_F64; CC1 = ISD::SETGE; break;
+	case ISD::SETLT:
+	case ISD::SETOLT: LC1 = RTLIB::OLT_F64; CC1 = ISD::SETLT; break;
+	case ISD::SETLE:
+	case ISD::SETOLE: LC1 = RTLIB::OLE_F64; CC1 = ISD::SETLE; break;
+	case ISD::SETGT:
+	case ISD::SETOGT: LC1 = RTLIB::OGT_F64; CC1 = ISD::SETGT; break;
+	case ISD::SETUO:  LC1 = RTLIB::UO_F64;  CC1 = ISD::SETNE; break;
+	case ISD::SETO:   LC1 = RTLIB::O_F64;   CC1 = ISD::SETEQ; break;
+	case ISD::SETUGE: LC1 = RTLIB::OLT_F64; CC1 = ISD::SETGE; break;
+	case ISD::SETUGT: LC1 = RTLIB::OLE_F64; CC1 = ISD::SETGT; break;
+	case ISD::SETULE: LC1 = RTLIB::OGT_F64; CC1 = ISD::SETLE; break;
+	case ISD::SETULT: LC1 = RTLIB::OGE_F64; CC1 = ISD::SETLT; break;
+	case ISD::SETONE:
+		LC1 = RTLIB::OGT_F64; CC1 = ISD::SETGT;
+		LC2 = RTLIB::OLT_F64; CC2 = ISD::SETLT;
+		break;
+	case ISD::SETUEQ:
+		LC1 = RTLIB::OEQ_F64; CC1 = ISD::SETEQ;
+		LC2 = RTLIB::UO_F64;  CC2 = ISD::SETNE;
+		break;
+	}
+
+	const SDValue Ops[] = { LHS, RHS };
+	SDValue Zero = DAG.getConstant(0, MVT::i32);
+
+	SDValue Res = makeLibCall(DAG, LC1, MVT::i32, Ops, 2, false, dl);
+	SDValue Bit = getConditionBit(Res, Zero, CC1, dl, DAG);
+	if (LC2 == RTLIB::UNKNOWN_LIBCALL)
+		return Bit;
+
+	Res = makeLibCall(DAG, LC2, MVT::i32, Ops, 2, false, dl);
+	return DAG.getNode(ISD::OR, dl, MVT::i32, Bit,
+	                   getConditionBit(Res, Zero, CC2, dl, DAG));
+}
+
+// u32 -> f32 without going through f64. Values with the sign bit set are
+// halved first, keeping the low bit so the conversion still rounds correctly,
+// and doubled back after it:
+//   x < 0 ? 2 * (float)((x >> 1) | (x & 1)) : (float)x
+static SDValue LowerUINT_TO_F32(SDValue Src, SDLoc dl, SelectionDAG &DAG)
+{
+	SDValue Zero = DAG.getConstant(0, MVT::i32);
+	SDValue One = DAG.getConstant(1, MVT::i32);
+
+	SDValue Half = DAG.getNode(ISD::OR, dl, MVT::i32,
+		DAG.getNode(ISD::SRL, dl, MVT::i32, Src, One),
+		DAG.getNode(ISD::AND, dl, MVT::i32, Src, One));
+	Half = DAG.getNode(ISD::SINT_TO_FP, dl, MVT::f32, Half);
+	SDValue Big = DAG.getNode(ISD::FADD, dl, MVT::f32, Half, Half);
+	SDValue Small = DAG.getNode(ISD::SINT_TO_FP, dl, MVT::f32, Src);
+
+	return DAG.getSelectCC(dl, Src, Zero, Big, Small, ISD::SETLT);
+}
+
+// Conversions involving i64 or f64 are libcalls. Of the f32 <-> i32 ones the
+// signed conversions are instructions, u32 -> f32 is built from them and
+// f32 -> u32 is expanded.
+SDValue MandarinTargetLowering::LowerFP_CONVERT(SDValue Op, SelectionDAG &DAG) const
+{
+	SDValue Src = Op.getOperand(0);
+	EVT SrcVT = Src.getValueType();
+	EVT DstVT = Op.getValueType();
+	RTLIB::Libcall LC;
+	bool isSigned = false;
+
+	if (SrcVT.getSizeInBits() != 64 && DstVT.getSizeInBits() != 64)
+	{
+		if (Op.getOpcode() == ISD::FP_TO_SINT || Op.getOpcode() == ISD::SINT_TO_FP)
+			return Op;
+		if (Op.getOpcode() == ISD::UINT_TO_FP)
+			return LowerUINT_TO_F32(Src, SDLoc(Op), DAG);
+		return SDValue();
+	}
+
+	switch (Op.getOpcode()) {
+	default:
+		llvm_unreachable("Unexpected conversion!");
+	case ISD::FP_TO_SINT:
+		LC = RTLIB::getFPTOSINT(SrcVT, DstVT);
+		isSigned = true;
+		break;
+	case ISD::FP_TO_UINT:
+		LC = RTLIB::getFPTOUINT(SrcVT, DstVT);
+		break;
+	case ISD::SINT_TO_FP:
+		LC = RTLIB::getSINTTOFP(SrcVT, DstVT);
+		isSigned = true;
+		break;
+	case ISD::UINT_TO_FP:
+		LC = RTLIB::getUINTTOFP(SrcVT, DstVT);
+		break;
+	case ISD::FP_EXTEND:
+		LC = RTLIB::getFPEXT(SrcVT, DstVT);
+		break;
+	case ISD::FP_ROUND:
+		LC = RTLIB::getFPROUND(SrcVT, DstVT);
+		break;
+	}
+	assert(LC != RTLIB::UNKNOWN_LIBCALL && "Unsupported conversion!");
+
+	return makeLibCall(DAG, LC, DstVT, &Src, 1, isSigned, SDLoc(Op));
+}
+
+//===----------------------------------------------------------------------===//
+// Vectors
+//
+// DoubleRegs, QuadRegs and OctRegs are tuples of GenericRegs. Lanes 0 and 1
+// are subregisters r2sub0/r2sub1, lanes 2 and 3 of a quad r4sub2/r4sub3 and
+// its halves are the DoubleRegs r4lo/r4hi. Likewise an oct has lanes
+// r8sub4..r8sub7 on top of those and its halves are the QuadRegs r8lo/r8hi.
+// Vectors are assembled from their lanes with a REG_SEQUENCE, so building and
+// permuting them costs at most one move per lane and never goes through
+// memory.
+//===----------------------------------------------------------------------===//
+
+static unsigned getLaneSubReg(unsigned NumElts, unsigned Lane) {
+	static const unsigned Sub2[] = { MD::r2sub0, MD::r2sub1 };
+	static const unsigned Sub4[] = { MD::r2sub0, MD::r2sub1, MD::r4sub2, MD::r4sub3 };
+	static const unsigned Sub8[] = { MD::r2sub0, MD::r2sub1, MD::r4sub2, MD::r4sub3,
+	                                 MD::r8sub4, MD::r8sub5, MD::r8sub6, MD::r8sub7 };
+	assert(Lane < NumElts && (NumElts == 2 || NumElts == 4 || NumElts == 8) &&
+	       "Bad vector lane");
+	return NumElts == 2 ? Sub2[Lane] : NumElts == 4 ? Sub4[Lane] : Sub8[Lane];
+}
+
+static SDValue getVectorLane(SDValue V, unsigned Lane, SDLoc dl, SelectionDAG &DAG) {
+	EVT VT = V.getValueType();
+	EVT EltVT = VT.getVectorElementType();
+	unsigned SubIdx = getLaneSubReg(VT.getVectorNumElements(), Lane);
+
+	if (V.getOpcode() == ISD::UNDEF)
+		return DAG.getUNDEF(EltVT);
+
+	if (V.getOpcode() == ISD::BUILD_VECTOR &&
+	    V.getOperand(Lane).getValueType() == EltVT)
+		return V.getOperand(Lane);
+
+	if (V.getOpcode() == MDISD::VSPLAT)
+		return V.getOperand(0);
+
+	if (V.isMachineOpcode() && V.getMachineOpcode() == TargetOpcode::REG_SEQUENCE)
+	{
+		for (unsigned i = 1, e = V.getNumOperands(); i + 1 < e; i += 2)
+			if (cast<ConstantSDNode>(V.getOperand(i + 1))->getZExtValue() == SubIdx)
+				return V.getOperand(i);
+	}
+
+	return DAG.getTargetExtractSubreg(SubIdx, dl, EltVT, V);
+}
+
+static SDValue getVectorFromLanes(EVT VT, const SDValue *Lanes, SDLoc dl,
+                                  SelectionDAG &DAG) {
+	unsigned NumElts = VT.getVectorNumElements();
+	unsigned RCID = NumElts == 2 ? MD::DoubleRegsRegClassID :
+	                NumElts == 4 ? MD::QuadRegsRegClassID : MD::OctRegsRegClassID;
+
+	SmallVector<SDValue, 17> Ops;
+	Ops.push_back(DAG.getTargetConstant(RCID, MVT::i32));
+	for (unsigned i = 0; i < NumElts; ++i)
+	{
+		Ops.push_back(Lanes[i]);
+		Ops.push_back(DAG.getTargetConstant(getLaneSubReg(NumElts, i), MVT::i32));
+	}
+	return SDValue(DAG.getMachineNode(TargetOpcode::REG_SEQUENCE, dl, VT, Ops), 0);
+}
+
+SDValue MandarinTargetLowering::LowerBUILD_VECTOR(SDValue Op, SelectionDAG &DAG) const
+{
+	EVT VT = Op.getValueType();
+	unsigned NumElts = VT.getVectorNumElements();
+	SDLoc dl(Op);
+
+	bool AllUndef = true, AllConstant = true, IsSplat = true;
+	SDValue Splat;
+	for (unsigned i = 0; i < NumElts; ++i)
+	{
+		SDValue Elt = Op.getOperand(i);
+		if (Elt.getOpcode() == ISD::UNDEF)
+			continue;
+		AllUndef = false;
+		if (!isa<ConstantSDNode>(Elt) && !isa<ConstantFPSDNode>(Elt))
+			AllConstant = false;
+		if (!Splat.getNode())
+			Splat = Elt;
+		else if (Splat != Elt)
+			IsSplat = false;
+	}
+
+	if (AllUndef)
+		return DAG.getUNDEF(VT);
+
+	// Constant vectors are a single load[N] from the constant pool. An integer
+	// splat is cheaper as one immediate copied into each lane, or folded into
+	// the immediate form of its user, FP constants would come from the pool
+	// anyway.
+	if (AllConstant && (!IsSplat || isa<ConstantFPSDNode>(Splat)))
+	{
+		Type *EltTy = VT.getVectorElementType().getTypeForEVT(*DAG.getContext());
+		SmallVector<Constant *, 8> CV;
+		for (unsigned i = 0; i < NumElts; ++i)
+		{
+			SDValue Elt = Op.getOperand(i);
+			if (ConstantSDNode *C = dyn_cast<ConstantSDNode>(Elt))
+				CV.push_back(ConstantInt::get(EltTy, C->getZExtValue()));
+			else if (ConstantFPSDNode *C = dyn_cast<ConstantFPSDNode>(Elt))
+				CV.push_back(const_cast<ConstantFP *>(C->getConstantFPValue()));
+			else
+				CV.push_back(UndefValue::get(EltTy));
+		}
+
+		SDValue CPIdx = DAG.getConstantPool(ConstantVector::get(CV), getPointerTy());
+		unsigned Align = cast<ConstantPoolSDNode>(CPIdx)->getAlignment();
+		return DAG.getLoad(VT, dl, DAG.getEntryNode(), CPIdx,
+		                   MachinePointerInfo::getConstantPool(),
+		                   false, false, false, Align);
+	}
+
+	if (IsSplat)
+		return DAG.getNode(MDISD::VSPLAT, dl, VT, Splat);
+
+	SDValue Lanes[8];
+	for (unsigned i = 0; i < NumElts; ++i)
+		Lanes[i] = Op.getOperand(i);
+	return getVectorFromLanes(VT, Lanes, dl, DAG);
+}
+
+SDValue MandarinTargetLowering::LowerSCALAR_TO_VECTOR(SDValue Op, SelectionDAG &DAG) const
+{
+	EVT VT = Op.getValueType();
+	SDLoc dl(Op);
+
+	SDValue Lanes[8];
+	Lanes[0] = Op.getOperand(0);
+	for (unsigned i = 1; i < VT.getVectorNumElements(); ++i)
+		Lanes[i] = DAG.getUNDEF(VT.getVectorElementType());
+	return getVectorFromLanes(VT, Lanes, dl, DAG);
+}
+
+SDValue MandarinTargetLowering::LowerVECTOR_SHUFFLE(SDValue Op, SelectionDAG &DAG) const
+{
+	ShuffleVectorSDNode *SVN = cast<ShuffleVectorSDNode>(Op.getNode());
+	SDValue V1 = Op.getOperand(0);
+	SDValue V2 = Op.getOperand(1);
+	EVT VT = Op.getValueType();
+	unsigned NumElts = VT.getVectorNumElements();
+	SDLoc dl(Op);
+
+	// Identity shuffles of either input are free.
+	bool IsIdentity1 = true, IsIdentity2 = true;
+	for (unsigned i = 0; i < NumElts; ++i)
+	{
+		int M = SVN->getMaskElt(i);
+		if (M < 0)
+			continue;
+		IsIdentity1 &= (unsigned)M == i;
+		IsIdentity2 &= (unsigned)M == i + NumElts;
+	}
+	if (IsIdentity1)
+		return V1;
+	if (IsIdentity2)
+		return V2;
+
+	// Splats and swizzles read each source lane once, CSE shares the
+	// subregister extracts between lanes that pick the same source.
+	SDValue Lanes[8];
+	for (unsigned i = 0; i < NumElts; ++i)
+	{
+		int M = SVN->getMaskElt(i);
+		if (M < 0)
+			Lanes[i] = DAG.getUNDEF(VT.getVectorElementType());
+		else if ((unsigned)M < NumElts)
+			Lanes[i] = getVectorLane(V1, M, dl, DAG);
+		else
+			Lanes[i] = getVectorLane(V2, M - NumElts, dl, DAG);
+	}
+	return getVectorFromLanes(VT, Lanes, dl, DAG);
+}
+
+SDValue MandarinTargetLowering::LowerINSERT_VECTOR_ELT(SDValue Op, SelectionDAG &DAG) const
+{
+	SDValue Vec = Op.getOperand(0);
+	SDValue Elt = Op.getOperand(1);
+	ConstantSDNode *Lane = dyn_cast<ConstantSDNode>(Op.getOperand(2));
+	EVT VT = Op.getValueType();
+	SDLoc dl(Op);
+
+	// Variable lanes go through the stack.
+	if (!Lane)
+		return SDValue();
+
+	unsigned NumElts = VT.getVectorNumElements();
+	unsigned Idx = Lane->getZExtValue();
+	if (Idx >= NumElts)
+		return DAG.getUNDEF(VT);
+
+	return DAG.getTargetInsertSubreg(getLaneSubReg(NumElts, Idx), dl, VT, Vec, Elt);
+}
+
+SDValue MandarinTargetLowering::LowerEXTRACT_SUBVECTOR(SDValue Op, SelectionDAG &DAG) const
+{
+	SDValue Vec = Op.getOperand(0);
+	ConstantSDNode *Idx = dyn_cast<ConstantSDNode>(Op.getOperand(1));
+	EVT VT = Op.getValueType();
+	SDLoc dl(Op);
+
+	// Only the halves of a quad or an oct are subregisters.
+	unsigned NumElts = Vec.getValueType().getVectorNumElements();
+	if (!Idx || (NumElts != 4 && NumElts != 8) ||
+	    (Idx->getZExtValue() != 0 && Idx->getZExtValue() != NumElts / 2))
+		return SDValue();
+
+	unsigned Lo = NumElts == 4 ? MD::r4lo : MD::r8lo;
+	unsigned Hi = NumElts == 4 ? MD::r4hi : MD::r8hi;
+	return DAG.getTargetExtractSubreg(Idx->isNullValue() ? Lo : Hi, dl, VT, Vec);
+}
+
+SDValue MandarinTargetLowering::LowerCONCAT_VECTORS(SDValue Op, SelectionDAG &DAG) const
+{
+	EVT VT = Op.getValueType();
+	SDLoc dl(Op);
+
+	if (Op.getNumOperands() != 2)
+		return SDValue();
+
+	bool IsQuad = VT.getVectorNumElements() == 4;
+	const SDValue Ops[] = {
+		DAG.getTargetConstant(IsQuad ? MD::QuadRegsRegClassID : MD::OctRegsRegClassID,
+		                      MVT::i32),
+		Op.getOperand(0), DAG.getTargetConstant(IsQuad ? MD::r4lo : MD::r8lo, MVT::i32),
+		Op.getOperand(1), DAG.getTargetConstant(IsQuad ? MD::r4hi : MD::r8hi, MVT::i32)
+	};
+	return SDValue(DAG.getMachineNode(TargetOpcode::REG_SEQUENCE, dl, VT, Ops), 0);
+}
+
+// NaN test as a 0/1 bit: the magnitude is above that of infinity. Both are
+// below 2^31, so the sign of their difference decides.
+static SDValue getIsNaNBit(SDValue V, SDLoc dl, SelectionDAG &DAG) {
+	EVT VT = V.getValueType();
+	EVT IntVT = VT.isVector() ? VT.changeVectorElementTypeToInteger() : EVT(MVT::i32);
+	SDValue Magnitude = DAG.getNode(ISD::AND, dl, IntVT,
+		DAG.getNode(ISD::BITCAST, dl, IntVT, V), DAG.getConstant(0x7FFFFFFF, IntVT));
+	return getSignToBit0(DAG.getNode(ISD::SUB, dl, IntVT,
+		DAG.getConstant(0x7F800000, IntVT), Magnitude), dl, DAG);
+}
+
+/// LowerVectorSETCC - There is no vector compare, the scalar condition
+/// formulas are applied lane-wise and the 0/1 bit is widened to the
+/// all-ones/zero lane mask.
+SDValue MandarinTargetLowering::LowerVectorSETCC(SDValue Op, SelectionDAG &DAG) const
 {
-	SDValue Value = Op.getOperand(0);
-	SDValue Lane = Op.getOperand(1);
-	if (!isa<ConstantSDNode>(Lane))
+	SDValue LHS = Op.getOperand(0);
+	SDValue RHS = Op.getOperand(1);
+	ISD::CondCode CC = cast<CondCodeSDNode>(Op.getOperand(2))->get();
+	SDLoc dl(Op);
+
+	SDValue Bit;
+	if (LHS.getValueType().isInteger() ||
+	    getIntCondForFloat(CC, getTargetMachine().Options.NoNaNsFPMath) != ISD::SETCC_INVALID)
+	{
+		Bit = getConditionBit(LHS, RHS, CC, dl, DAG);
+	}
+	else
+	{
+		// NaN sensitive float compare: the integer compare of the ordered bits
+		// corrected by a lane-wise NaN test.
+		SDValue X = getOrderedFloatBits(LHS, dl, DAG);
+		SDValue Y = getOrderedFloatBits(RHS, dl, DAG);
+		EVT VT = X.getValueType();
+		SDValue Unordered = DAG.getNode(ISD::OR, dl, VT,
+			getIsNaNBit(LHS, dl, DAG), getIsNaNBit(RHS, dl, DAG));
+		SDValue One = DAG.getConstant(1, VT);
+
+		if (CC == ISD::SETUO)
+			Bit = Unordered;
+		else if (CC == ISD::SETO)
+			Bit = DAG.getNode(ISD::XOR, dl, VT, Unordered, One);
+		else
+		{
+			ISD::CondCode IntCC = getIntCondForFloat(CC, true);
+			if (IntCC == ISD::SETCC_INVALID)
+				return SDValue();
+
+			Bit = getConditionBit(X, Y, IntCC, dl, DAG);
+			if (ISD::getUnorderedFlavor(CC) == 1)
+				Bit = DAG.getNode(ISD::OR, dl, VT, Bit, Unordered);
+			else
+				Bit = DAG.getNode(ISD::AND, dl, VT, Bit,
+					DAG.getNode(ISD::XOR, dl, VT, Unordered, One));
+		}
+	}
+
+	// Anything else is unrolled.
+	if (!Bit.getNode())
 		return SDValue();
 
-	Op.dump();
+	return getNeg(Bit, dl, DAG);
+}
+
+/// LowerVSELECT - Blend with the lane mask: f ^ ((t ^ f) & mask).
+SDValue MandarinTargetLowering::LowerVSELECT(SDValue Op, SelectionDAG &DAG) const
+{
+	SDValue Mask = Op.getOperand(0);
+	SDValue TrueVal = Op.getOperand(1);
+	SDValue FalseVal = Op.getOperand(2);
+	EVT VT = Op.getValueType();
+	EVT IntVT = VT.changeVectorElementTypeToInteger();
+	SDLoc dl(Op);
+
+	SDValue T = DAG.getNode(ISD::BITCAST, dl, IntVT, TrueVal);
+	SDValue F = DAG.getNode(ISD::BITCAST, dl, IntVT, FalseVal);
+	Mask = DAG.getNode(ISD::BITCAST, dl, IntVT, Mask);
+
+	SDValue Res = DAG.getNode(ISD::XOR, dl, IntVT, F,
+		DAG.getNode(ISD::AND, dl, IntVT,
+			DAG.getNode(ISD::XOR, dl, IntVT, T, F), Mask));
+	return DAG.getNode(ISD::BITCAST, dl, VT, Res);
+}
 
-	Op.getOperand(0).dump();
-	Op.getOperand(1).dump();
+SDValue MandarinTargetLowering::LowerEXTRACT_VECTOR_ELT(SDValue Op, SelectionDAG &DAG) const
+{
+	SDValue Vec = Op.getOperand(0);
+	ConstantSDNode *Lane = dyn_cast<ConstantSDNode>(Op.getOperand(1));
+	EVT VT = Vec.getValueType();
+	SDLoc dl(Op);
 
-	//return DAG.getNode(MDISD::;
+	// Variable lanes go through the stack.
+	if (!Lane)
+		return SDValue();
 
-	return Op;
+	// A constant lane is a subregister, the copy out of it is normally
+	// coalesced away.
+	unsigned Idx = Lane->getZExtValue();
+	if (Idx >= VT.getVectorNumElements())
+		return DAG.getUNDEF(Op.getValueType());
+
+	return getVectorLane(Vec, Idx, dl, DAG);
 }
 
 SDValue MandarinTargetLowering::
@@ -878,10 +2501,61 @@ LowerOperation(SDValue Op, SelectionDAG &DAG) const {
 	  return LowerBR_CC(Op, DAG);
   case ISD::SELECT_CC:
 	  return LowerSELECT_CC(Op, DAG);
+  case ISD::SETCC:
+	  return LowerSETCC(Op, DAG);
+  case ISD::UDIV:
+  case ISD::UREM:
+  case ISD::UDIVREM:
+	  return LowerUDIVREM(Op, DAG);
+  case ISD::ADD:
+  case ISD::SUB:
+	  return LowerADDSUB64(Op, DAG);
+  case ISD::SHL:
+  case ISD::SRL:
+	  return LowerShift64(Op, DAG);
+  case ISD::SRA:
+	  if (Op.getValueType() == MVT::i64)
+		  return LowerShift64(Op, DAG);
+	  return LowerSRA(Op, DAG);
+  case ISD::ZERO_EXTEND:
+  case ISD::SIGN_EXTEND:
+  case ISD::ANY_EXTEND:
+	  return LowerEXTEND64(Op, DAG);
+  case ISD::FP_TO_SINT:
+  case ISD::FP_TO_UINT:
+  case ISD::SINT_TO_FP:
+  case ISD::UINT_TO_FP:
+  case ISD::FP_EXTEND:
+  case ISD::FP_ROUND:
+	  return LowerFP_CONVERT(Op, DAG);
+  case ISD::SIGN_EXTEND_INREG:
+	  return LowerSIGN_EXTEND_INREG(Op, DAG);
+  case ISD::FABS:
+	  return LowerFABS(Op, DAG);
+  case ISD::FNEG:
+	  return LowerFNEG(Op, DAG);
+  case ISD::FCOPYSIGN:
+	  return LowerFCOPYSIGN(Op, DAG);
+  case ISD::BUILD_VECTOR:
+	  return LowerBUILD_VECTOR(Op, DAG);
+  case ISD::SCALAR_TO_VECTOR:
+	  return LowerSCALAR_TO_VECTOR(Op, DAG);
+  case ISD::VECTOR_SHUFFLE:
+	  return LowerVECTOR_SHUFFLE(Op, DAG);
+  case ISD::INSERT_VECTOR_ELT:
+	  return LowerINSERT_VECTOR_ELT(Op, DAG);
   case ISD::EXTRACT_VECTOR_ELT:
 	  return LowerEXTRACT_VECTOR_ELT(Op, DAG);
+  case ISD::EXTRACT_SUBVECTOR:
+	  return LowerEXTRACT_SUBVECTOR(Op, DAG);
+  case ISD::CONCAT_VECTORS:
+	  return LowerCONCAT_VECTORS(Op, DAG);
+  case ISD::VSELECT:
+	  return LowerVSELECT(Op, DAG);
   case ISD::GlobalAddress:
   case ISD::ConstantPool:
+  case ISD::JumpTable:
+  case ISD::BlockAddress:
 	  return LowerAddress(Op, DAG);
 
   /*case ISD::RETURNADDR:         return LowerRETURNADDR(Op, DAG, *this);
@@ -990,8 +2664,90 @@ MandarinTargetLowering::getRegForInlineAsmConstraint(const std::string &Constrai
 
 bool
 MandarinTargetLowering::isOffsetFoldingLegal(const GlobalAddressSDNode *GA) const {
-  // The Mandarin target isn't yet aware of offsets.
-  return false;
+  // The offset is folded into the hi16/lo16 relocations, there is no GOT.
+  return getTargetMachine().getRelocationModel() != Reloc::PIC_;
+}
+
+unsigned MandarinTargetLowering::getIntImmKindCost(MDImm::Kind Kind) const {
+  switch (Kind) {
+  case MDImm::LDI:       return 1;
+  case MDImm::NOT:       return 2;
+  case MDImm::SHL:       return 2;
+  case MDImm::NOT_SHL:   return 3;
+  case MDImm::CONSTPOOL: return 3; // one instruction, but a memory access
+  case MDImm::LDI_HI_LO: return 4;
+  }
+  llvm_unreachable("Unknown immediate kind");
+}
+
+MDImm::Kind
+MandarinTargetLowering::getIntImmKind(uint32_t Imm, uint32_t &Val,
+                                      unsigned &Shift) const {
+  // The generic sequence builds anything, the others replace it when they
+  // apply and are strictly cheaper than the best one so far. Candidates are
+  // tried in order of preference, so ties go to the sequence without a
+  // memory access.
+  MDImm::Kind Best = MDImm::LDI_HI_LO;
+  Val = Imm;
+  Shift = 0;
+
+  MDImm::Kind Kinds[4] = { MDImm::LDI, MDImm::NOT, MDImm::SHL, MDImm::NOT_SHL };
+  for (unsigned i = 0; i != 4; ++i) {
+    MDImm::Kind Kind = Kinds[i];
+    // Covers -1 and small negative numbers as well: ~x fits whenever -x does.
+    bool Invert = Kind == MDImm::NOT || Kind == MDImm::NOT_SHL;
+    uint32_t Bits = Invert ? ~Imm : Imm;
+    unsigned Amt = 0;
+    if (Kind == MDImm::SHL || Kind == MDImm::NOT_SHL)
+      Amt = countTrailingZeros(Bits);
+
+    if (Amt < 32 && isUInt<19>(Bits >> Amt) &&
+        getIntImmKindCost(Kind) < getIntImmKindCost(Best)) {
+      Best = Kind;
+      Val = Bits >> Amt;
+      Shift = Amt;
+    }
+  }
+
+  // A constant pool entry is a single absolute load when the pool is
+  // reachable with a lo16 address.
+  switch (getTargetMachine().getCodeModel()) {
+  case CodeModel::Default:
+  case CodeModel::JITDefault:
+  case CodeModel::Small:
+    if (getIntImmKindCost(MDImm::CONSTPOOL) < getIntImmKindCost(Best)) {
+      Best = MDImm::CONSTPOOL;
+      Val = Imm;
+      Shift = 0;
+    }
+    break;
+  default:
+    break;
+  }
+
+  return Best;
+}
+
+unsigned MandarinTargetLowering::getIntImmCost(const APInt &Imm) const {
+  // Wider values are built from 32 bit parts.
+  if (!Imm.isIntN(32) && !Imm.isSignedIntN(32))
+    return getIntImmKindCost(MDImm::LDI_HI_LO) * ((Imm.getBitWidth() + 31) / 32);
+
+  uint32_t Val;
+  unsigned Shift;
+  return getIntImmKindCost(
+    getIntImmKind((uint32_t)Imm.zextOrTrunc(32).getZExtValue(), Val, Shift));
+}
+
+/// isLegalICmpImmediate - scmp takes a signed 19 bit immediate.
+bool MandarinTargetLowering::isLegalICmpImmediate(int64_t Imm) const {
+  return isInt<19>(Imm);
+}
+
+/// isLegalAddImmediate - add/sub take an unsigned 14 bit immediate, negative
+/// addends are selected as sub.
+bool MandarinTargetLowering::isLegalAddImmediate(int64_t Imm) const {
+  return isUInt<14>(Imm < 0 ? -Imm : Imm);
 }
 
 void MandarinTargetLowering::ReplaceNodeResults(SDNode *N,
@@ -38,6 +38,30 @@ namespace llvm {
 	  LOW,
 
 	  CALL,
+
+	  /// Tail call: a jump to the callee after the epilogue. Operands are the
+	  /// chain, the callee and the argument registers.
+	  TAIL_CALL,
+
+	  /// Broadcast of the scalar operand to all lanes of a vector.
+	  VSPLAT,
+
+	  /// Signed division, selected to div. Unlike ISD::SDIV the combiner
+	  /// doesn't turn it into udiv when both operands are known positive.
+	  SDIV,
+    };
+  }
+
+  namespace MDImm {
+    /// Ways to materialize a 32 bit integer constant, see
+    /// MandarinTargetLowering::getIntImmKind.
+    enum Kind {
+      LDI,        // ldi Val
+      NOT,        // not (ldi Val)
+      SHL,        // shl (ldi Val), Shift
+      NOT_SHL,    // not (shl (ldi Val), Shift)
+      CONSTPOOL,  // load lo16(cpi)
+      LDI_HI_LO   // or (ldi lo19), (shl (ldi hi13), 19)
     };
   }
 
@@ -56,6 +80,11 @@ namespace llvm {
                                                 const SelectionDAG &DAG,
                                                 unsigned Depth = 0) const;
 
+    virtual unsigned ComputeNumSignBitsForTargetNode(SDValue Op,
+                                                     unsigned Depth = 0) const;
+
+    virtual SDValue PerformDAGCombine(SDNode *N, DAGCombinerInfo &DCI) const;
+
 	/// Targets can use this to indicate that they only support *some*
 	/// VECTOR_SHUFFLE operations, those with specific masks.  By default, if a
 	/// target supports the VECTOR_SHUFFLE node, all mask values are assumed to be
@@ -77,6 +106,21 @@ namespace llvm {
     getRegForInlineAsmConstraint(const std::string &Constraint, MVT VT) const;
 
     virtual bool isOffsetFoldingLegal(const GlobalAddressSDNode *GA) const;
+
+    /// getIntImmKind - Return the cheapest way to materialize Imm in a
+    /// register, comparing the costs of the sequences that can build it. Val
+    /// and Shift receive the operands of the chosen sequence.
+    MDImm::Kind getIntImmKind(uint32_t Imm, uint32_t &Val, unsigned &Shift) const;
+
+    /// getIntImmKindCost - Return the cost, in instructions, of a sequence.
+    unsigned getIntImmKindCost(MDImm::Kind Kind) const;
+
+    /// getIntImmCost - Return the cost, in instructions, of materializing Imm
+    /// in a register. Instruction selection uses the same sequence.
+    unsigned getIntImmCost(const APInt &Imm) const;
+
+    virtual bool isLegalICmpImmediate(int64_t Imm) const;
+    virtual bool isLegalAddImmediate(int64_t Imm) const;
     virtual MVT getScalarShiftAmountTy(EVT LHSTy) const { return MVT::i32; }
 
     /// getSetCCResultType - Return the ISD::SETCC ValueType
@@ -94,12 +138,26 @@ namespace llvm {
       LowerCall(TargetLowering::CallLoweringInfo &CLI,
                 SmallVectorImpl<SDValue> &InVals) const;
 
+	bool IsEligibleForTailCallOptimization(CCState &CCInfo,
+	                                       CallingConv::ID CalleeCC,
+	                                       bool isVarArg,
+	                                       const SmallVectorImpl<ISD::OutputArg> &Outs,
+	                                       const SmallVectorImpl<SDValue> &OutVals,
+	                                       const SmallVectorImpl<CCValAssign> &ArgLocs,
+	                                       SelectionDAG &DAG) const;
+
 	SDValue LowerCallResult(SDValue Chain, SDValue InFlag,
                             CallingConv::ID CallConv, bool isVarArg,
                             const SmallVectorImpl<ISD::InputArg> &Ins,
                             SDLoc dl, SelectionDAG &DAG,
                             SmallVectorImpl<SDValue> &InVals) const;
 
+    virtual bool
+      CanLowerReturn(CallingConv::ID CallConv, MachineFunction &MF,
+                     bool isVarArg,
+                     const SmallVectorImpl<ISD::OutputArg> &Outs,
+                     LLVMContext &Context) const;
+
     virtual SDValue
       LowerReturn(SDValue Chain,
                   CallingConv::ID CallConv, bool isVarArg,
@@ -111,7 +169,35 @@ namespace llvm {
 	SDValue LowerAddress(SDValue Op, SelectionDAG &DAG) const;
 	SDValue LowerBR_CC(SDValue Op, SelectionDAG &DAG) const;
 	SDValue LowerSELECT_CC(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerSETCC(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerSRA(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerUDIVREM(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerSIGN_EXTEND_INREG(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerFABS(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerFNEG(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerFCOPYSIGN(SDValue Op, SelectionDAG &DAG) const;
+	SDValue EmitSelectCC(SDValue LHS, SDValue RHS, SDValue TrueVal,
+	                     SDValue FalseVal, ISD::CondCode CC, SDLoc dl,
+	                     SelectionDAG &DAG) const;
+	SDValue getConditionBit(SDValue LHS, SDValue RHS, ISD::CondCode CC,
+	                        SDLoc dl, SelectionDAG &DAG) const;
+	SDValue getConditionBit64(SDValue LHS, SDValue RHS, ISD::CondCode CC,
+	                          SDLoc dl, SelectionDAG &DAG) const;
+	SDValue LowerADDSUB64(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerShift64(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerEXTEND64(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerFP_CONVERT(SDValue Op, SelectionDAG &DAG) const;
+	SDValue getConditionBitF64(SDValue LHS, SDValue RHS, ISD::CondCode CC,
+	                           SDLoc dl, SelectionDAG &DAG) const;
+	SDValue LowerBUILD_VECTOR(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerSCALAR_TO_VECTOR(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerVECTOR_SHUFFLE(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerINSERT_VECTOR_ELT(SDValue Op, SelectionDAG &DAG) const;
 	SDValue LowerEXTRACT_VECTOR_ELT(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerEXTRACT_SUBVECTOR(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerCONCAT_VECTORS(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerVectorSETCC(SDValue Op, SelectionDAG &DAG) const;
+	SDValue LowerVSELECT(SDValue Op, SelectionDAG &DAG) const;
 
     bool ShouldShrinkFPConstant(EVT VT) const {
       // Do not shrink FP constpool if VT == MVT::f128.
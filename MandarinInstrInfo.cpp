@@ -43,19 +43,20 @@ MandarinInstrInfo::MandarinInstrInfo(MandarinSubtarget &ST)
 unsigned MandarinInstrInfo::isLoadFromStackSlot(const MachineInstr *MI,
                                              int &FrameIndex) const
 {
-	MI->dump();
-
-  /*if (MI->getOpcode() == MD::LOADri ||
-      MI->getOpcode() == SP::LDXri ||
-      MI->getOpcode() == SP::LDFri ||
-      MI->getOpcode() == SP::LDDFri ||
-      MI->getOpcode() == SP::LDQFri) {
+  if (MI->getOpcode() == MD::LOADrri ||
+      MI->getOpcode() == MD::LOADfrri ||
+      MI->getOpcode() == MD::LOAD2rri ||
+      MI->getOpcode() == MD::LOAD2frri ||
+      MI->getOpcode() == MD::LOAD4rri ||
+      MI->getOpcode() == MD::LOAD4frri ||
+      MI->getOpcode() == MD::LOAD8rri ||
+      MI->getOpcode() == MD::LOAD8frri) {
     if (MI->getOperand(1).isFI() && MI->getOperand(2).isImm() &&
         MI->getOperand(2).getImm() == 0) {
       FrameIndex = MI->getOperand(1).getIndex();
       return MI->getOperand(0).getReg();
     }
-  }*/
+  }
 
   return 0;
 }
@@ -68,19 +69,20 @@ unsigned MandarinInstrInfo::isLoadFromStackSlot(const MachineInstr *MI,
 unsigned MandarinInstrInfo::isStoreToStackSlot(const MachineInstr *MI,
                                             int &FrameIndex) const
 {
-	MI->dump();
-
-  /*if (MI->getOpcode() == SP::STri ||
-      MI->getOpcode() == SP::STXri ||
-      MI->getOpcode() == SP::STFri ||
-      MI->getOpcode() == SP::STDFri ||
-      MI->getOpcode() == SP::STQFri) {
-    if (MI->getOperand(0).isFI() && MI->getOperand(1).isImm() &&
-        MI->getOperand(1).getImm() == 0) {
-      FrameIndex = MI->getOperand(0).getIndex();
-      return MI->getOperand(2).getReg();
+  if (MI->getOpcode() == MD::STORErri ||
+      MI->getOpcode() == MD::STOREfrri ||
+      MI->getOpcode() == MD::STORE2rri ||
+      MI->getOpcode() == MD::STORE2frri ||
+      MI->getOpcode() == MD::STORE4rri ||
+      MI->getOpcode() == MD::STORE4frri ||
+      MI->getOpcode() == MD::STORE8rri ||
+      MI->getOpcode() == MD::STORE8frri) {
+    if (MI->getOperand(1).isFI() && MI->getOperand(2).isImm() &&
+        MI->getOperand(2).getImm() == 0) {
+      FrameIndex = MI->getOperand(1).getIndex();
+      return MI->getOperand(0).getReg();
     }
-  }*/
+  }
 
   return 0;
 }
@@ -106,8 +108,8 @@ bool MandarinInstrInfo::AnalyzeBranch(MachineBasicBlock &MBB,
     if (!I->isBranch())
       return true;
 
-	// Cannot handle indirect branches.
-	if (I->getOpcode() == MD::JMPr || I->getOpcode() == MD::JCCr)
+	// Cannot handle indirect branches (jump table dispatch).
+	if (I->isIndirectBranch())
       return true;
 
 	// Handle unconditional branches.
@@ -210,10 +212,10 @@ unsigned MandarinInstrInfo::RemoveBranch(MachineBasicBlock &MBB) const
     if (I->isDebugValue())
       continue;
 
+	// Indirect branches are never reported by AnalyzeBranch, so they must
+	// not be removed here either.
 	if (I->getOpcode() != MD::JMPi &&
-        I->getOpcode() != MD::JCCi &&
-        I->getOpcode() != MD::JMPr &&
-		I->getOpcode() != MD::JCCr)
+        I->getOpcode() != MD::JCCi)
       break; // Not a branch
 
 	// Remove the branch.
@@ -250,6 +252,10 @@ void MandarinInstrInfo::copyPhysReg(MachineBasicBlock &MBB,
 	{
 		printf("Registers are already there\n");
 	}
+	else if(MD::OctRegsRegClass.contains(DestReg, SrcReg))
+	{
+		BuildMI(MBB, I, DL, get(MD::MOV8rr), DestReg).addReg(SrcReg, getKillRegState(KillSrc));
+	}
 	else
 	{
 		llvm_unreachable("Impossible reg-to-reg copy");
@@ -278,14 +284,21 @@ storeRegToStackSlot(MachineBasicBlock &MBB, MachineBasicBlock::iterator MI,
 								MFI.getObjectSize(FrameIndex),
 								MFI.getObjectAlignment(FrameIndex));
 
-	if (RC == &MD::GenericRegsRegClass)
-	{
-		BuildMI(MBB, MI, DL, get(MD::STORErr))
-		  .addFrameIndex(FrameIndex).addImm(0)
-		  .addReg(SrcReg, getKillRegState(isKill)).addMemOperand(MMO);
-	}else{
+	unsigned Opc;
+	if (MD::GenericRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::STORErri;
+	else if (MD::DoubleRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::STORE2rri;
+	else if (MD::QuadRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::STORE4rri;
+	else if (MD::OctRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::STORE8rri;
+	else
 		llvm_unreachable("Cannot store this register to stack slot!");
-	}
+
+	BuildMI(MBB, MI, DL, get(Opc))
+	  .addReg(SrcReg, getKillRegState(isKill))
+	  .addFrameIndex(FrameIndex).addImm(0).addMemOperand(MMO);
 }
 
 /// loadRegFromStackSlot - Load the specified register of the given register
@@ -310,11 +323,18 @@ loadRegFromStackSlot(MachineBasicBlock &MBB, MachineBasicBlock::iterator MI,
 								MFI.getObjectSize(FrameIndex),
 								MFI.getObjectAlignment(FrameIndex));
 
-	if (RC == &MD::GenericRegsRegClass)
-	{
-		BuildMI(MBB, MI, DL, get(MD::LOADrr), DestReg)
-		  .addFrameIndex(FrameIndex).addImm(0).addMemOperand(MMO);
-	}else{
-		llvm_unreachable("Cannot store this register to stack slot!");
-	}
+	unsigned Opc;
+	if (MD::GenericRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::LOADrri;
+	else if (MD::DoubleRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::LOAD2rri;
+	else if (MD::QuadRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::LOAD4rri;
+	else if (MD::OctRegsRegClass.hasSubClassEq(RC))
+		Opc = MD::LOAD8rri;
+	else
+		llvm_unreachable("Cannot load this register from stack slot!");
+
+	BuildMI(MBB, MI, DL, get(Opc), DestReg)
+	  .addFrameIndex(FrameIndex).addImm(0).addMemOperand(MMO);
 }
@@ -0,0 +1,344 @@
+//===-- MandarinLoadStoreOptimizer.cpp - Merge word loads and stores ------===//
+//
+//                     Vyacheslav Egorov
+//
+// This file is distributed under the MIT License
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass merges word loads and stores to consecutive addresses into the
+// load[2]/load[4] and store[2]/store[4] forms. Loaded words are read back out
+// of the wide register through its subregisters, stored words are gathered
+// with a REG_SEQUENCE. It runs on SSA form before register allocation, so the
+// coalescer can usually assign the scalars straight into the wide register.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "mandarin-ldst-opt"
+#include "Mandarin.h"
+#include "MandarinTargetMachine.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineMemOperand.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+using namespace llvm;
+
+STATISTIC(NumLoad2, "Number of load[2] formed");
+STATISTIC(NumLoad4, "Number of load[4] formed");
+STATISTIC(NumStore2, "Number of store[2] formed");
+STATISTIC(NumStore4, "Number of store[4] formed");
+
+namespace {
+
+/// A word access to Base + Offset. Base is either a virtual register or a
+/// frame index.
+struct MemAccess {
+  MachineInstr *MI;
+  const MachineOperand *Base;
+  int64_t Offset;
+  unsigned Position;
+
+  MemAccess(MachineInstr *mi, const MachineOperand *base, int64_t offset,
+            unsigned position)
+    : MI(mi), Base(base), Offset(offset), Position(position) {}
+};
+
+struct OffsetCompare {
+  bool operator()(const MemAccess &A, const MemAccess &B) const {
+    if (A.Offset != B.Offset)
+      return A.Offset < B.Offset;
+    return A.Position < B.Position;
+  }
+};
+
+typedef SmallVector<MemAccess, 16> AccessList;
+
+class MandarinLoadStoreOptimizer : public MachineFunctionPass {
+  const TargetInstrInfo *TII;
+  MachineRegisterInfo *MRI;
+
+public:
+  static char ID;
+  MandarinLoadStoreOptimizer() : MachineFunctionPass(ID) {}
+
+  virtual const char *getPassName() const {
+    return "Mandarin load / store merging";
+  }
+
+  virtual bool runOnMachineFunction(MachineFunction &MF);
+
+private:
+  bool optimizeBlock(MachineBasicBlock &MBB);
+  bool mergeAccesses(MachineBasicBlock &MBB, AccessList &Accesses, bool IsLoad);
+  void mergeLoads(MachineBasicBlock &MBB, const MemAccess *Group, unsigned N);
+  void mergeStores(MachineBasicBlock &MBB, const MemAccess *Group, unsigned N);
+};
+
+char MandarinLoadStoreOptimizer::ID = 0;
+
+} // end anonymous namespace
+
+static bool isWordLoad(unsigned Opc) {
+  return Opc == MD::LOADrr || Opc == MD::LOADrri ||
+         Opc == MD::LOADfrr || Opc == MD::LOADfrri;
+}
+
+static bool isWordStore(unsigned Opc) {
+  return Opc == MD::STORErr || Opc == MD::STORErri ||
+         Opc == MD::STOREfrr || Opc == MD::STOREfrri;
+}
+
+static bool isSameBase(const MachineOperand *A, const MachineOperand *B) {
+  if (A->isReg() && B->isReg())
+    return A->getReg() == B->getReg();
+  if (A->isFI() && B->isFI())
+    return A->getIndex() == B->getIndex();
+  return false;
+}
+
+/// Return true if MI is a plain word access that may take part in a merge,
+/// filling in its address.
+static bool getWordAccess(MachineInstr *MI, const MachineOperand *&Base,
+                          int64_t &Offset) {
+  unsigned Opc = MI->getOpcode();
+  if (!isWordLoad(Opc) && !isWordStore(Opc))
+    return false;
+
+  if (!MI->hasOneMemOperand())
+    return false;
+  const MachineMemOperand *MMO = *MI->memoperands_begin();
+  if (MMO->isVolatile() || MMO->getSize() != 4 || MMO->getAlignment() < 4)
+    return false;
+
+  // The value register, both the loaded and the stored one, must be virtual
+  // so it can be rewritten in terms of the wide register.
+  const MachineOperand &Val = MI->getOperand(0);
+  if (!Val.isReg() || !TargetRegisterInfo::isVirtualRegister(Val.getReg()) ||
+      Val.getSubReg())
+    return false;
+
+  Base = &MI->getOperand(1);
+  if (Base->isReg()) {
+    if (!TargetRegisterInfo::isVirtualRegister(Base->getReg()))
+      return false;
+  } else if (!Base->isFI()) {
+    return false;
+  }
+
+  Offset = 0;
+  if (MI->getNumOperands() > 2 && MI->getOperand(2).isImm())
+    Offset = MI->getOperand(2).getImm();
+  return true;
+}
+
+static MachineMemOperand *getWideMemOperand(MachineFunction &MF,
+                                            const MemAccess &First, unsigned N) {
+  const MachineMemOperand *MMO = *First.MI->memoperands_begin();
+  return MF.getMachineMemOperand(MMO, 0, 4 * N);
+}
+
+static const unsigned Sub2[] = { MD::r2sub0, MD::r2sub1 };
+static const unsigned Sub4[] = { MD::r2sub0, MD::r2sub1, MD::r4sub2, MD::r4sub3 };
+
+/// Replace N loads at consecutive words with one load[N] placed at the
+/// earliest of them, the original destinations become subregister copies.
+void MandarinLoadStoreOptimizer::mergeLoads(MachineBasicBlock &MBB,
+                                            const MemAccess *Group, unsigned N) {
+  const MemAccess *First = Group;
+  for (unsigned i = 1; i < N; ++i)
+    if (Group[i].Position < First->Position)
+      First = &Group[i];
+
+  MachineBasicBlock::iterator InsertPt = First->MI;
+  DebugLoc DL = First->MI->getDebugLoc();
+  MachineFunction &MF = *MBB.getParent();
+
+  unsigned Wide = MRI->createVirtualRegister(N == 4 ? &MD::QuadRegsRegClass
+                                                    : &MD::DoubleRegsRegClass);
+  MachineInstrBuilder MIB =
+    BuildMI(MBB, InsertPt, DL, TII->get(N == 4 ? MD::LOAD4rri : MD::LOAD2rri), Wide);
+  if (Group[0].Base->isReg()) {
+    MIB.addReg(Group[0].Base->getReg());
+    MRI->clearKillFlags(Group[0].Base->getReg());
+  } else {
+    MIB.addFrameIndex(Group[0].Base->getIndex());
+  }
+  MIB.addImm(Group[0].Offset).addMemOperand(getWideMemOperand(MF, Group[0], N));
+
+  for (unsigned i = 0; i < N; ++i) {
+    BuildMI(MBB, InsertPt, DL, TII->get(TargetOpcode::COPY),
+            Group[i].MI->getOperand(0).getReg())
+      .addReg(Wide, 0, N == 4 ? Sub4[i] : Sub2[i]);
+    Group[i].MI->eraseFromParent();
+  }
+
+  if (N == 4)
+    ++NumLoad4;
+  else
+    ++NumLoad2;
+}
+
+/// Replace N stores to consecutive words with one store[N] placed at the
+/// latest of them, the stored values are gathered with a REG_SEQUENCE.
+void MandarinLoadStoreOptimizer::mergeStores(MachineBasicBlock &MBB,
+                                             const MemAccess *Group, unsigned N) {
+  const MemAccess *Last = Group;
+  for (unsigned i = 1; i < N; ++i)
+    if (Group[i].Position > Last->Position)
+      Last = &Group[i];
+
+  MachineBasicBlock::iterator InsertPt = Last->MI;
+  DebugLoc DL = Last->MI->getDebugLoc();
+  MachineFunction &MF = *MBB.getParent();
+
+  unsigned Wide = MRI->createVirtualRegister(N == 4 ? &MD::QuadRegsRegClass
+                                                    : &MD::DoubleRegsRegClass);
+  MachineInstrBuilder Seq =
+    BuildMI(MBB, InsertPt, DL, TII->get(TargetOpcode::REG_SEQUENCE), Wide);
+  for (unsigned i = 0; i < N; ++i) {
+    unsigned Src = Group[i].MI->getOperand(0).getReg();
+    // The value is now used at the merged store, later than before.
+    MRI->clearKillFlags(Src);
+    Seq.addReg(Src).addImm(N == 4 ? Sub4[i] : Sub2[i]);
+  }
+
+  MachineInstrBuilder MIB =
+    BuildMI(MBB, InsertPt, DL, TII->get(N == 4 ? MD::STORE4rri : MD::STORE2rri))
+      .addReg(Wide, RegState::Kill);
+  if (Group[0].Base->isReg()) {
+    MIB.addReg(Group[0].Base->getReg());
+    MRI->clearKillFlags(Group[0].Base->getReg());
+  } else {
+    MIB.addFrameIndex(Group[0].Base->getIndex());
+  }
+  MIB.addImm(Group[0].Offset).addMemOperand(getWideMemOperand(MF, Group[0], N));
+
+  for (unsigned i = 0; i < N; ++i)
+    Group[i].MI->eraseFromParent();
+
+  if (N == 4)
+    ++NumStore4;
+  else
+    ++NumStore2;
+}
+
+/// Merge the accesses collected since the last memory barrier. Accesses are
+/// grouped by base and sorted by offset, runs of four consecutive words become
+/// quads and whatever is left pairs up.
+bool MandarinLoadStoreOptimizer::mergeAccesses(MachineBasicBlock &MBB,
+                                               AccessList &Accesses,
+                                               bool IsLoad) {
+  bool Changed = false;
+
+  while (Accesses.size() > 1) {
+    // Pull out every access sharing the base of the first one.
+    AccessList Group;
+    AccessList Rest;
+    for (unsigned i = 0, e = Accesses.size(); i != e; ++i) {
+      if (isSameBase(Accesses[i].Base, Accesses[0].Base))
+        Group.push_back(Accesses[i]);
+      else
+        Rest.push_back(Accesses[i]);
+    }
+    Accesses.swap(Rest);
+
+    std::sort(Group.begin(), Group.end(), OffsetCompare());
+
+    for (unsigned i = 0, e = Group.size(); i < e; ) {
+      unsigned N = 1;
+      while (N < 4 && i + N < e &&
+             Group[i + N].Offset == Group[i].Offset + 4 * N)
+        ++N;
+
+      if (N == 3)
+        N = 2;
+      if (N < 2) {
+        ++i;
+        continue;
+      }
+
+      if (IsLoad)
+        mergeLoads(MBB, &Group[i], N);
+      else
+        mergeStores(MBB, &Group[i], N);
+      Changed = true;
+      i += N;
+    }
+  }
+
+  Accesses.clear();
+  return Changed;
+}
+
+bool MandarinLoadStoreOptimizer::optimizeBlock(MachineBasicBlock &MBB) {
+  bool Changed = false;
+  AccessList Loads;
+  AccessList Stores;
+  unsigned Position = 0;
+
+  for (MachineBasicBlock::iterator I = MBB.begin(), E = MBB.end(); I != E;
+       ++I, ++Position) {
+    MachineInstr *MI = I;
+    if (MI->isDebugValue())
+      continue;
+
+    const MachineOperand *Base;
+    int64_t Offset;
+    bool IsAccess = getWordAccess(MI, Base, Offset);
+
+    if (IsAccess && isWordLoad(MI->getOpcode())) {
+      // Stores are sunk to the last of their group, which must not cross a
+      // load. Loads are hoisted to the first one and may cross other loads.
+      Changed |= mergeAccesses(MBB, Stores, false);
+      Loads.push_back(MemAccess(MI, Base, Offset, Position));
+      continue;
+    }
+
+    if (IsAccess) {
+      Changed |= mergeAccesses(MBB, Loads, true);
+
+      // The merged store is placed at the last of the group, so it must not
+      // cross a store through another base, which may alias any of its
+      // words, nor a second store to the same word.
+      bool Flush = !Stores.empty() && !isSameBase(Stores[0].Base, Base);
+      for (unsigned i = 0, e = Stores.size(); i != e && !Flush; ++i)
+        Flush = Stores[i].Offset == Offset;
+      if (Flush)
+        Changed |= mergeAccesses(MBB, Stores, false);
+      Stores.push_back(MemAccess(MI, Base, Offset, Position));
+      continue;
+    }
+
+    if (MI->isCall() || MI->hasUnmodeledSideEffects() || MI->mayStore()) {
+      Changed |= mergeAccesses(MBB, Loads, true);
+      Changed |= mergeAccesses(MBB, Stores, false);
+    } else if (MI->mayLoad()) {
+      Changed |= mergeAccesses(MBB, Stores, false);
+    }
+  }
+
+  Changed |= mergeAccesses(MBB, Loads, true);
+  Changed |= mergeAccesses(MBB, Stores, false);
+  return Changed;
+}
+
+bool MandarinLoadStoreOptimizer::runOnMachineFunction(MachineFunction &MF) {
+  TII = MF.getTarget().getInstrInfo();
+  MRI = &MF.getRegInfo();
+
+  bool Changed = false;
+  for (MachineFunction::iterator MBB = MF.begin(), E = MF.end(); MBB != E; ++MBB)
+    Changed |= optimizeBlock(*MBB);
+  return Changed;
+}
+
+/// createMandarinLoadStoreOptimizerPass - Returns a pass that merges
+/// consecutive word loads and stores into load[N]/store[N].
+FunctionPass *llvm::createMandarinLoadStoreOptimizerPass() {
+  return new MandarinLoadStoreOptimizer();
+}
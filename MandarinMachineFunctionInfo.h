@@ -30,17 +30,26 @@ namespace llvm {
 
     /// IsLeafProc - True if the function is a leaf procedure.
     bool IsLeafProc;
+
+    /// IncomingArgSize - Size of the stack area holding the incoming
+    /// arguments. Tail calls may reuse it for their own stack arguments.
+    unsigned IncomingArgSize;
   public:
     MandarinMachineFunctionInfo()
-      : GlobalBaseReg(0), VarArgsFrameOffset(0), SRetReturnReg(0) {}
+      : GlobalBaseReg(0), VarArgsFrameOffset(0), SRetReturnReg(0),
+        IncomingArgSize(0) {}
     explicit MandarinMachineFunctionInfo(MachineFunction &MF)
-      : GlobalBaseReg(0), VarArgsFrameOffset(0), SRetReturnReg(0) {}
+      : GlobalBaseReg(0), VarArgsFrameOffset(0), SRetReturnReg(0),
+        IncomingArgSize(0) {}
 
     int getVarArgsFrameOffset() const { return VarArgsFrameOffset; }
     void setVarArgsFrameOffset(int Offset) { VarArgsFrameOffset = Offset; }
 
     unsigned getSRetReturnReg() const { return SRetReturnReg; }
     void setSRetReturnReg(unsigned Reg) { SRetReturnReg = Reg; }
+
+    unsigned getIncomingArgSize() const { return IncomingArgSize; }
+    void setIncomingArgSize(unsigned Size) { IncomingArgSize = Size; }
   };
 }
 
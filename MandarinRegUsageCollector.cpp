@@ -0,0 +1,115 @@
+//===-- MandarinRegUsageCollector.cpp - Record clobbered registers --------===//
+//
+//                     Vyacheslav Egorov
+//
+// This file is distributed under the MIT License
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass records the physical registers a function clobbers once its code
+// is final. Calls to the function lowered later in the module use that set
+// instead of the calling convention's one, so a caller can keep its values in
+// the registers a small callee leaves alone rather than spilling them around
+// the call. Functions are compiled in module order, only callees defined
+// before their callers benefit. The sets live on the register info shared by
+// the whole target machine, so they are dropped at module boundaries and the
+// pass must not run on several modules concurrently.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "mandarin-reg-usage"
+#include "Mandarin.h"
+#include "MandarinTargetMachine.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstr.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+STATISTIC(NumFunctions, "Number of functions with a recorded clobber set");
+
+namespace {
+
+class MandarinRegUsageCollector : public MachineFunctionPass {
+public:
+  static char ID;
+  MandarinRegUsageCollector(MandarinTargetMachine &tm)
+    : MachineFunctionPass(ID), TM(tm) {}
+
+  virtual const char *getPassName() const {
+    return "Mandarin register usage collector";
+  }
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.setPreservesAll();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+  virtual bool doInitialization(Module &M);
+  virtual bool doFinalization(Module &M);
+  virtual bool runOnMachineFunction(MachineFunction &MF);
+
+private:
+  MandarinTargetMachine &TM;
+};
+
+char MandarinRegUsageCollector::ID = 0;
+
+} // end anonymous namespace
+
+bool MandarinRegUsageCollector::doInitialization(Module &M) {
+  TM.getRegisterInfo()->clearCallPreservedMasks();
+  return false;
+}
+
+bool MandarinRegUsageCollector::doFinalization(Module &M) {
+  TM.getRegisterInfo()->clearCallPreservedMasks();
+  return false;
+}
+
+bool MandarinRegUsageCollector::runOnMachineFunction(MachineFunction &MF) {
+  const MandarinRegisterInfo *TRI = TM.getRegisterInfo();
+  unsigned NumRegs = TRI->getNumRegs();
+  BitVector Clobbered(NumRegs);
+
+  for (MachineFunction::const_iterator MBB = MF.begin(), E = MF.end();
+       MBB != E; ++MBB) {
+    for (MachineBasicBlock::const_iterator MI = MBB->begin(), ME = MBB->end();
+         MI != ME; ++MI) {
+      for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+        const MachineOperand &MO = MI->getOperand(i);
+
+        // A call clobbers whatever its callee doesn't preserve.
+        if (MO.isRegMask()) {
+          for (unsigned Reg = 1; Reg != NumRegs; ++Reg)
+            if (MO.clobbersPhysReg(Reg))
+              Clobbered.set(Reg);
+          continue;
+        }
+
+        if (!MO.isReg() || !MO.isDef() || !MO.getReg())
+          continue;
+
+        // Writing a register changes every tuple overlapping it.
+        for (MCRegAliasIterator AI(MO.getReg(), TRI, true); AI.isValid(); ++AI)
+          Clobbered.set(*AI);
+      }
+    }
+  }
+
+  DEBUG(dbgs() << MF.getName() << " clobbers " << Clobbered.count()
+               << " of " << NumRegs << " registers\n");
+
+  TRI->setCallPreservedMask(MF.getFunction(), Clobbered);
+  ++NumFunctions;
+  return false;
+}
+
+/// createMandarinRegUsageCollectorPass - Returns a pass that records the
+/// registers each function clobbers for the calls compiled after it.
+FunctionPass *llvm::createMandarinRegUsageCollectorPass(MandarinTargetMachine &TM) {
+  return new MandarinRegUsageCollector(TM);
+}
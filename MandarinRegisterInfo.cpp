@@ -36,10 +36,39 @@ MandarinRegisterInfo::MandarinRegisterInfo(MandarinSubtarget &st)
 
 const uint16_t* MandarinRegisterInfo::getCalleeSavedRegs(const MachineFunction *MF)
                                                                          const {
-  static const uint16_t CalleeSavedRegs[] = {
-    0
-  };
-  return CalleeSavedRegs;
+  return CSR_Mandarin_SaveList;
+}
+
+const uint32_t*
+MandarinRegisterInfo::getCallPreservedMask(CallingConv::ID CC) const {
+  return CSR_Mandarin_RegMask;
+}
+
+const uint32_t*
+MandarinRegisterInfo::getCallPreservedMask(const Function *Callee,
+                                           CallingConv::ID CC) const {
+  std::map<const Function *, std::vector<uint32_t> >::const_iterator I =
+    CalleeMasks.find(Callee);
+  if (I == CalleeMasks.end())
+    return getCallPreservedMask(CC);
+  return &I->second[0];
+}
+
+void MandarinRegisterInfo::setCallPreservedMask(const Function *F,
+                                                const BitVector &Clobbered) const {
+  // Whatever the function does, the calling convention preserves the
+  // callee-saved registers and the stack pointer. The frame pointer is
+  // only reserved in functions that have a frame, elsewhere it is an
+  // ordinary register and may be clobbered.
+  unsigned MaskWords = (getNumRegs() + 31) / 32;
+  std::vector<uint32_t> &Mask = CalleeMasks[F];
+  Mask.assign(MaskWords, 0);
+  for (unsigned Reg = 1, e = getNumRegs(); Reg != e; ++Reg)
+    if (!Clobbered.test(Reg))
+      Mask[Reg / 32] |= 1u << (Reg % 32);
+  for (unsigned i = 0; i != MaskWords; ++i)
+    Mask[i] |= CSR_Mandarin_RegMask[i];
+  Mask[MD::R30 / 32] |= 1u << (MD::R30 % 32);
 }
 
 BitVector MandarinRegisterInfo::getReservedRegs(const MachineFunction &MF) const {
@@ -77,22 +106,63 @@ MandarinRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator II,
   unsigned BasePtr = (TFI->hasFP(MF) ? MD::R31 : MD::R30);
   int Offset = MF.getFrameInfo()->getObjectOffset(FrameIndex);
 
+  // The stack grows up: without a frame pointer the objects are addressed
+  // below the already adjusted stack pointer.
   if (!TFI->hasFP(MF))
-    Offset += MF.getFrameInfo()->getStackSize();
+    Offset -= MF.getFrameInfo()->getStackSize();
 
   MachineRegisterInfo &RegInfo = MF.getRegInfo();
   const TargetInstrInfo &TII = *MF.getTarget().getInstrInfo();
 
+  // Register+offset memory forms and ADDri carry a displacement right after
+  // the frame index, try to fold the object offset into it.
+  if (FIOperandNum + 1 < MI.getNumOperands() &&
+      MI.getOperand(FIOperandNum + 1).isImm()) {
+    MachineOperand &ImmOp = MI.getOperand(FIOperandNum + 1);
+    Offset += ImmOp.getImm();
+
+    if (MI.getOpcode() == MD::ADDri) {
+      if (isUInt<14>(Offset)) {
+        MI.getOperand(FIOperandNum).ChangeToRegister(BasePtr, false);
+        ImmOp.setImm(Offset);
+        return;
+      }
+      if (isUInt<14>(-Offset)) {
+        MI.setDesc(TII.get(MD::SUBri));
+        MI.getOperand(FIOperandNum).ChangeToRegister(BasePtr, false);
+        ImmOp.setImm(-Offset);
+        return;
+      }
+    } else if (isInt<14>(Offset)) {
+      MI.getOperand(FIOperandNum).ChangeToRegister(BasePtr, false);
+      ImmOp.setImm(Offset);
+      return;
+    }
+
+    ImmOp.setImm(0);
+  }
+
   unsigned VReg = BasePtr;
   
   if(Offset)
   {
 	  VReg = RegInfo.createVirtualRegister(&MD::GenericRegsRegClass);
 
-	  if(Offset > 0)
-		  BuildMI(MBB, II, dl, TII.get(MD::ADDri), VReg).addReg(BasePtr).addImm(Offset);
+	  unsigned Disp = Offset > 0 ? Offset : -Offset;
+
+	  if (isUInt<14>(Disp))
+	  {
+		  BuildMI(MBB, II, dl, TII.get(Offset > 0 ? MD::ADDri : MD::SUBri), VReg)
+			  .addReg(BasePtr).addImm(Disp);
+	  }
 	  else
-		  BuildMI(MBB, II, dl, TII.get(MD::SUBri), VReg).addReg(BasePtr).addImm(Offset);
+	  {
+		  // Frames larger than the immediate field, materialize the offset.
+		  unsigned DispReg = RegInfo.createVirtualRegister(&MD::GenericRegsRegClass);
+		  BuildMI(MBB, II, dl, TII.get(MD::LDIri), DispReg).addImm(Disp);
+		  BuildMI(MBB, II, dl, TII.get(Offset > 0 ? MD::ADDrr : MD::SUBrr), VReg)
+			  .addReg(BasePtr).addReg(DispReg, RegState::Kill);
+	  }
   }
 
   MI.getOperand(FIOperandNum).ChangeToRegister(VReg, false);
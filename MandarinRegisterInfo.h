@@ -14,12 +14,15 @@
 #define MANDARINREGISTERINFO_H
 
 #include "llvm/Target/TargetRegisterInfo.h"
+#include <map>
+#include <vector>
 
 #define GET_REGINFO_HEADER
 #include "MandarinGenRegisterInfo.inc"
 
 namespace llvm {
 
+class Function;
 class MandarinSubtarget;
 class TargetInstrInfo;
 class Type;
@@ -27,10 +30,29 @@ class Type;
 struct MandarinRegisterInfo : public MandarinGenRegisterInfo {
   MandarinSubtarget &Subtarget;
 
+  /// Preserved register masks of the functions of the current module
+  /// compiled so far, filled in by the register usage collector. It is reset
+  /// for every module, the -mandarin-ipra mode is single-threaded.
+  mutable std::map<const Function *, std::vector<uint32_t> > CalleeMasks;
+
   MandarinRegisterInfo(MandarinSubtarget &st);
 
   /// Code Generation virtual methods...
   const uint16_t *getCalleeSavedRegs(const MachineFunction *MF = 0) const;
+  const uint32_t *getCallPreservedMask(CallingConv::ID CC) const;
+
+  /// getCallPreservedMask - The registers preserved by a call to Callee, the
+  /// ones it was seen not to clobber if it has been compiled already.
+  const uint32_t *getCallPreservedMask(const Function *Callee,
+                                       CallingConv::ID CC) const;
+
+  /// setCallPreservedMask - Record the registers clobbered by the body of F
+  /// for the calls compiled after it.
+  void setCallPreservedMask(const Function *F, const BitVector &Clobbered) const;
+
+  /// clearCallPreservedMasks - Forget the masks recorded for the previous
+  /// module.
+  void clearCallPreservedMasks() const { CalleeMasks.clear(); }
 
   BitVector getReservedRegs(const MachineFunction &MF) const;
 
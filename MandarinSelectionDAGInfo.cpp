@@ -12,11 +12,215 @@
 
 #define DEBUG_TYPE "mandarin-selectiondag-info"
 #include "MandarinTargetMachine.h"
+#include "llvm/CodeGen/SelectionDAG.h"
 using namespace llvm;
 
+// Largest constant-sized memcpy/memset expanded inline, anything bigger goes
+// to the runtime. memmove keeps every loaded block live before the first
+// store, so its limit is the quad register file rather than code size.
+static const uint64_t MaxInlineBytes = 128;
+static const uint64_t MaxInlineMoveBytes = 64;
+
+// Number of load[4] issued ahead of their store[4] in a copy.
+static const unsigned CopyBatchSize = 4;
+
 MandarinSelectionDAGInfo::MandarinSelectionDAGInfo(const MandarinTargetMachine &TM)
   : TargetSelectionDAGInfo(TM) {
 }
 
 MandarinSelectionDAGInfo::~MandarinSelectionDAGInfo() {
 }
+
+// Split a block into the widest transfers available: load[4]/store[4] quads,
+// then a pair, a word, a halfword and a byte for the tail.
+static void getTransfers(uint64_t Size,
+                         SmallVectorImpl<std::pair<MVT, uint64_t> > &Transfers) {
+  static const MVT Types[] = { MVT::v4i32, MVT::v2i32, MVT::i32, MVT::i16, MVT::i8 };
+
+  uint64_t Offset = 0;
+  for (unsigned i = 0; i < array_lengthof(Types); ++i) {
+    uint64_t Bytes = Types[i].getStoreSize();
+    for (; Size - Offset >= Bytes; Offset += Bytes)
+      Transfers.push_back(std::make_pair(Types[i], Offset));
+  }
+}
+
+static SDValue getOffsetPtr(SelectionDAG &DAG, SDLoc dl, SDValue Ptr,
+                            uint64_t Offset) {
+  if (Offset == 0)
+    return Ptr;
+  EVT PtrVT = Ptr.getValueType();
+  return DAG.getNode(ISD::ADD, dl, PtrVT, Ptr, DAG.getConstant(Offset, PtrVT));
+}
+
+static SDValue emitLoad(SelectionDAG &DAG, SDLoc dl, SDValue Chain, SDValue Src,
+                        MVT VT, uint64_t Offset, unsigned Align, bool isVolatile,
+                        MachinePointerInfo SrcPtrInfo) {
+  SDValue Ptr = getOffsetPtr(DAG, dl, Src, Offset);
+  unsigned A = MinAlign(Align, Offset);
+  if (VT.getSizeInBits() < 32)
+    return DAG.getExtLoad(ISD::EXTLOAD, dl, MVT::i32, Chain, Ptr,
+                          SrcPtrInfo.getWithOffset(Offset), VT,
+                          isVolatile, false, A);
+  return DAG.getLoad(VT, dl, Chain, Ptr, SrcPtrInfo.getWithOffset(Offset),
+                     isVolatile, false, false, A);
+}
+
+static SDValue emitStore(SelectionDAG &DAG, SDLoc dl, SDValue Chain, SDValue Val,
+                         SDValue Dst, MVT VT, uint64_t Offset, unsigned Align,
+                         bool isVolatile, MachinePointerInfo DstPtrInfo) {
+  SDValue Ptr = getOffsetPtr(DAG, dl, Dst, Offset);
+  unsigned A = MinAlign(Align, Offset);
+  if (VT.getSizeInBits() < 32)
+    return DAG.getTruncStore(Chain, dl, Val, Ptr,
+                             DstPtrInfo.getWithOffset(Offset), VT,
+                             isVolatile, false, A);
+  return DAG.getStore(Chain, dl, Val, Ptr, DstPtrInfo.getWithOffset(Offset),
+                      isVolatile, false, A);
+}
+
+// Copy Size bytes in batches: every load of a batch is issued before its
+// stores so the quad transfers can overlap. With BatchSize covering the whole
+// block all loads precede all stores, which is what memmove needs.
+static SDValue emitBlockCopy(SelectionDAG &DAG, SDLoc dl, SDValue Chain,
+                             SDValue Dst, SDValue Src, uint64_t Size,
+                             unsigned Align, bool isVolatile, unsigned BatchSize,
+                             MachinePointerInfo DstPtrInfo,
+                             MachinePointerInfo SrcPtrInfo) {
+  SmallVector<std::pair<MVT, uint64_t>, 16> Transfers;
+  getTransfers(Size, Transfers);
+
+  for (unsigned i = 0, e = Transfers.size(); i < e; i += BatchSize) {
+    unsigned n = std::min(BatchSize, e - i);
+    SmallVector<SDValue, 16> Values;
+    SmallVector<SDValue, 16> Chains;
+
+    for (unsigned j = 0; j < n; ++j) {
+      SDValue Load = emitLoad(DAG, dl, Chain, Src, Transfers[i + j].first,
+                              Transfers[i + j].second, Align, isVolatile,
+                              SrcPtrInfo);
+      Values.push_back(Load);
+      Chains.push_back(Load.getValue(1));
+    }
+    Chain = DAG.getNode(ISD::TokenFactor, dl, MVT::Other, &Chains[0], n);
+
+    Chains.clear();
+    for (unsigned j = 0; j < n; ++j)
+      Chains.push_back(emitStore(DAG, dl, Chain, Values[j], Dst,
+                                 Transfers[i + j].first, Transfers[i + j].second,
+                                 Align, isVolatile, DstPtrInfo));
+    Chain = DAG.getNode(ISD::TokenFactor, dl, MVT::Other, &Chains[0], n);
+  }
+
+  return Chain;
+}
+
+SDValue
+MandarinSelectionDAGInfo::EmitTargetCodeForMemcpy(SelectionDAG &DAG, SDLoc dl,
+                                                  SDValue Chain,
+                                                  SDValue Dst, SDValue Src,
+                                                  SDValue Size, unsigned Align,
+                                                  bool isVolatile, bool AlwaysInline,
+                                                  MachinePointerInfo DstPtrInfo,
+                                                  MachinePointerInfo SrcPtrInfo) const {
+  // Block transfers need word alignment, leave the rest to the generic code.
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstSize || (Align & 3) != 0)
+    return SDValue();
+
+  uint64_t Bytes = ConstSize->getZExtValue();
+  if (!AlwaysInline && Bytes > MaxInlineBytes)
+    return SDValue();
+
+  return emitBlockCopy(DAG, dl, Chain, Dst, Src, Bytes, Align, isVolatile,
+                       CopyBatchSize, DstPtrInfo, SrcPtrInfo);
+}
+
+SDValue
+MandarinSelectionDAGInfo::EmitTargetCodeForMemmove(SelectionDAG &DAG, SDLoc dl,
+                                                   SDValue Chain,
+                                                   SDValue Dst, SDValue Src,
+                                                   SDValue Size, unsigned Align,
+                                                   bool isVolatile,
+                                                   MachinePointerInfo DstPtrInfo,
+                                                   MachinePointerInfo SrcPtrInfo) const {
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstSize || (Align & 3) != 0)
+    return SDValue();
+
+  uint64_t Bytes = ConstSize->getZExtValue();
+  if (Bytes > MaxInlineMoveBytes)
+    return SDValue();
+
+  return emitBlockCopy(DAG, dl, Chain, Dst, Src, Bytes, Align, isVolatile,
+                       ~0U, DstPtrInfo, SrcPtrInfo);
+}
+
+SDValue
+MandarinSelectionDAGInfo::EmitTargetCodeForMemset(SelectionDAG &DAG, SDLoc dl,
+                                                  SDValue Chain,
+                                                  SDValue Dst, SDValue Src,
+                                                  SDValue Size, unsigned Align,
+                                                  bool isVolatile,
+                                                  MachinePointerInfo DstPtrInfo) const {
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstSize || (Align & 3) != 0)
+    return SDValue();
+
+  uint64_t Bytes = ConstSize->getZExtValue();
+  if (Bytes > MaxInlineBytes)
+    return SDValue();
+
+  // Replicate the fill byte across a word.
+  SDValue Word;
+  if (ConstantSDNode *C = dyn_cast<ConstantSDNode>(Src)) {
+    uint32_t Byte = C->getZExtValue() & 0xff;
+    Word = DAG.getConstant(Byte * 0x01010101U, MVT::i32);
+  } else {
+    Word = DAG.getZeroExtendInReg(DAG.getZExtOrTrunc(Src, dl, MVT::i32),
+                                  dl, MVT::i8);
+    Word = DAG.getNode(ISD::MUL, dl, MVT::i32, Word,
+                       DAG.getConstant(0x01010101U, MVT::i32));
+  }
+
+  // Quads and pairs of the word are assembled straight into registers.
+  const SDValue PairOps[] = {
+    DAG.getTargetConstant(MD::DoubleRegsRegClassID, MVT::i32),
+    Word, DAG.getTargetConstant(MD::r2sub0, MVT::i32),
+    Word, DAG.getTargetConstant(MD::r2sub1, MVT::i32)
+  };
+  const SDValue QuadOps[] = {
+    DAG.getTargetConstant(MD::QuadRegsRegClassID, MVT::i32),
+    Word, DAG.getTargetConstant(MD::r2sub0, MVT::i32),
+    Word, DAG.getTargetConstant(MD::r2sub1, MVT::i32),
+    Word, DAG.getTargetConstant(MD::r4sub2, MVT::i32),
+    Word, DAG.getTargetConstant(MD::r4sub3, MVT::i32)
+  };
+
+  SmallVector<std::pair<MVT, uint64_t>, 16> Transfers;
+  getTransfers(Bytes, Transfers);
+
+  SDValue Pair, Quad;
+  SmallVector<SDValue, 16> Chains;
+  for (unsigned i = 0, e = Transfers.size(); i < e; ++i) {
+    MVT VT = Transfers[i].first;
+    SDValue Val = Word;
+    if (VT == MVT::v4i32) {
+      if (!Quad.getNode())
+        Quad = SDValue(DAG.getMachineNode(TargetOpcode::REG_SEQUENCE, dl,
+                                          MVT::v4i32, QuadOps), 0);
+      Val = Quad;
+    } else if (VT == MVT::v2i32) {
+      if (!Pair.getNode())
+        Pair = SDValue(DAG.getMachineNode(TargetOpcode::REG_SEQUENCE, dl,
+                                          MVT::v2i32, PairOps), 0);
+      Val = Pair;
+    }
+    Chains.push_back(emitStore(DAG, dl, Chain, Val, Dst, VT, Transfers[i].second,
+                               Align, isVolatile, DstPtrInfo));
+  }
+
+  if (Chains.empty())
+    return Chain;
+  return DAG.getNode(ISD::TokenFactor, dl, MVT::Other, &Chains[0], Chains.size());
+}
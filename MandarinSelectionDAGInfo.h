@@ -23,6 +23,29 @@ class MandarinSelectionDAGInfo : public TargetSelectionDAGInfo {
 public:
   explicit MandarinSelectionDAGInfo(const MandarinTargetMachine &TM);
   ~MandarinSelectionDAGInfo();
+
+  virtual SDValue EmitTargetCodeForMemcpy(SelectionDAG &DAG, SDLoc dl,
+                                          SDValue Chain,
+                                          SDValue Dst, SDValue Src,
+                                          SDValue Size, unsigned Align,
+                                          bool isVolatile, bool AlwaysInline,
+                                          MachinePointerInfo DstPtrInfo,
+                                          MachinePointerInfo SrcPtrInfo) const;
+
+  virtual SDValue EmitTargetCodeForMemmove(SelectionDAG &DAG, SDLoc dl,
+                                           SDValue Chain,
+                                           SDValue Dst, SDValue Src,
+                                           SDValue Size, unsigned Align,
+                                           bool isVolatile,
+                                           MachinePointerInfo DstPtrInfo,
+                                           MachinePointerInfo SrcPtrInfo) const;
+
+  virtual SDValue EmitTargetCodeForMemset(SelectionDAG &DAG, SDLoc dl,
+                                          SDValue Chain,
+                                          SDValue Dst, SDValue Src,
+                                          SDValue Size, unsigned Align,
+                                          bool isVolatile,
+                                          MachinePointerInfo DstPtrInfo) const;
 };
 
 }
@@ -13,9 +13,15 @@
 #include "Mandarin.h"
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/PassManager.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/TargetRegistry.h"
 using namespace llvm;
 
+static cl::opt<bool>
+EnableIPRA("mandarin-ipra", cl::Hidden, cl::init(false),
+           cl::desc("Give calls to functions compiled earlier in the module "
+                    "the registers they actually clobber"));
+
 namespace llvm {
 class Target;
 
@@ -58,6 +64,7 @@ public:
   }
 
   virtual bool addInstSelector();
+  virtual bool addPreRegAlloc();
   virtual bool addPreEmitPass();
 };
 } // namespace
@@ -71,6 +78,12 @@ bool MandarinPassConfig::addInstSelector() {
   return false;
 }
 
+bool MandarinPassConfig::addPreRegAlloc() {
+  if (getOptLevel() != CodeGenOpt::None)
+    addPass(createMandarinLoadStoreOptimizerPass());
+  return false;
+}
+
 bool MandarinTargetMachine::addCodeEmitter(PassManagerBase &PM,
                                         JITCodeEmitter &JCE) {
   // Machine code emitter pass for Mandarin.
@@ -82,5 +95,7 @@ bool MandarinTargetMachine::addCodeEmitter(PassManagerBase &PM,
 /// passes immediately before machine code is emitted.  This should return
 /// true if -print-machineinstrs should print out the code after the passes.
 bool MandarinPassConfig::addPreEmitPass(){
+  if (EnableIPRA)
+    addPass(createMandarinRegUsageCollectorPass(getMandarinTargetMachine()));
   return true;
 }